@@ -0,0 +1,219 @@
+// Compares the iterators generated by `iterator_tpl.h` with raw pointer
+// loops and `std::vector` iterators, and prints the results as JSON.
+//
+// Use `make bench` to run it with the usual optimization levels.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../iterator_tpl.h"
+
+#ifndef BENCH_FLAGS
+#define BENCH_FLAGS "unknown"
+#endif
+
+/* * * * * CONTAINERS: * * * * */
+
+// Same as the README example, plus random access:
+struct Ref {
+  std::vector<int> vec;
+
+  struct it_state {
+    std::ptrdiff_t pos;
+    inline void next(const Ref* ref) { ++pos; }
+    inline void prev(const Ref* ref) { --pos; }
+    inline void begin(const Ref* ref) { pos = 0; }
+    inline void end(const Ref* ref) { pos = ref->vec.size(); }
+    inline int& get(Ref* ref) { return ref->vec[pos]; }
+    inline const int& get(const Ref* ref) { return ref->vec[pos]; }
+    inline bool equals(const it_state& s) const { return pos == s.pos; }
+    inline void advance(const Ref* ref, std::ptrdiff_t n) { pos += n; }
+    inline std::ptrdiff_t distance(const Ref* ref, const it_state& s) const {
+      return pos - s.pos;
+    }
+  };
+  SETUP_ITERATORS(Ref, int&, it_state);
+  SETUP_REVERSE_ITERATORS(Ref, int&, it_state);
+};
+
+// Same as `examples/rvalue.cpp`:
+struct RValue {
+  std::vector<int> vec;
+  int offset;
+
+  struct it_state {
+    std::ptrdiff_t pos;
+    inline void next(const RValue* ref) { ++pos; }
+    inline void begin(const RValue* ref) { pos = 0; }
+    inline void end(const RValue* ref) { pos = ref->vec.size(); }
+    inline int get(const RValue* ref) { return ref->offset + ref->vec[pos]; }
+    inline bool equals(const it_state& s) const { return pos == s.pos; }
+  };
+  SETUP_ITERATORS(RValue, int, it_state);
+};
+
+// Same as `examples/filter.cpp`:
+struct Filtered {
+  std::vector<int> vec;
+
+  struct keep {
+    bool operator()(int x) const { return x % 4 == 0; }
+  };
+
+  struct it_state {
+    std::ptrdiff_t pos;
+    inline void next(const Filtered* ref) { ++pos; }
+    inline void begin(const Filtered* ref) { pos = 0; }
+    inline void end(const Filtered* ref) { pos = ref->vec.size(); }
+    inline int& get(Filtered* ref) { return ref->vec[pos]; }
+    inline const int& get(const Filtered* ref) { return ref->vec[pos]; }
+    inline bool equals(const it_state& s) const { return pos == s.pos; }
+  };
+  SETUP_FILTERED_ITERATORS(Filtered, int&, it_state, keep);
+};
+
+/* * * * * MEASURING: * * * * */
+
+// Prevents the compiler from optimizing away the benchmarked code:
+template <typename T>
+inline void escape(const T& value) {
+  asm volatile("" : : "g"(&value) : "memory");
+}
+
+// Returns the fastest of a few runs in nanoseconds per element,
+// each run processing about `budget` elements:
+template <class F>
+double measure(F f, std::size_t size, std::size_t budget = 20000000) {
+  std::size_t reps = std::max<std::size_t>(1, budget / size);
+  double best = 1e300;
+  for (int run = 0; run < 5; ++run) {
+    double elapsed = 0;
+    for (std::size_t i = 0; i < reps; ++i) elapsed += f();
+    best = std::min(best, elapsed);
+  }
+  return best / (double(reps) * size);
+}
+
+// Times `body()` in nanoseconds:
+template <class F>
+double timed(F body) {
+  typedef std::chrono::steady_clock clock;
+  clock::time_point start = clock::now();
+  body();
+  return std::chrono::duration<double, std::nano>(clock::now() - start).count();
+}
+
+// Searched by the "find" benchmarks, but never found:
+static volatile int missing = -1;
+
+static bool first_result = true;
+
+void report(const char* variant, const char* op, std::size_t size, double ns) {
+  std::printf("%s\n    {\"variant\": \"%s\", \"op\": \"%s\", \"size\": %zu, "
+              "\"ns_per_element\": %.4f}",
+              first_result ? "" : ",", variant, op, size, ns);
+  first_result = false;
+}
+
+/* * * * * BENCHMARKS: * * * * */
+
+template <class It>
+void bench_iterators(const char* variant, std::size_t size, It first, It last,
+                     std::vector<int>& out) {
+  report(variant, "sum", size, measure([&] {
+    return timed([&] {
+      long sum = 0;
+      for (It it = first; it != last; ++it) sum += *it;
+      escape(sum);
+    });
+  }, size));
+
+  report(variant, "find", size, measure([&] {
+    int needle = missing;
+    return timed([&] { escape(std::find(first, last, needle)); });
+  }, size));
+
+  report(variant, "copy", size, measure([&] {
+    return timed([&] { escape(std::copy(first, last, out.begin())); });
+  }, size));
+
+}
+
+template <class It>
+void bench_sort(const char* variant, std::size_t size, It first, It last,
+                const std::vector<int>& shuffled) {
+  report(variant, "sort", size, measure([&] {
+    std::copy(shuffled.begin(), shuffled.end(), first);
+    return timed([&] { std::sort(first, last); });
+  }, size, 2000000));
+}
+
+void bench_size(std::size_t size) {
+  std::vector<int> shuffled(size);
+  std::iota(shuffled.begin(), shuffled.end(), 0);
+  std::shuffle(shuffled.begin(), shuffled.end(), std::mt19937(42));
+  std::vector<int> out(size);
+
+  std::vector<int> vec = shuffled;
+  bench_iterators("raw_pointer", size, vec.data(), vec.data() + size, out);
+  bench_iterators("std_vector", size, vec.begin(), vec.end(), out);
+  bench_iterators("std_vector_reverse", size, vec.rbegin(), vec.rend(), out);
+  bench_sort("raw_pointer", size, vec.data(), vec.data() + size, shuffled);
+  bench_sort("std_vector", size, vec.begin(), vec.end(), shuffled);
+  bench_sort("std_vector_reverse", size, vec.rbegin(), vec.rend(), shuffled);
+
+  Ref ref;
+  ref.vec = shuffled;
+  bench_iterators("tpl_reference", size, ref.begin(), ref.end(), out);
+  bench_iterators("tpl_reverse", size, ref.rbegin(), ref.rend(), out);
+  bench_sort("tpl_reference", size, ref.begin(), ref.end(), shuffled);
+  bench_sort("tpl_reverse", size, ref.rbegin(), ref.rend(), shuffled);
+
+  RValue rvalue;
+  rvalue.vec = shuffled;
+  rvalue.offset = 1;
+  bench_iterators("tpl_rvalue", size, rvalue.begin(), rvalue.end(), out);
+
+  // The filter is compared with the equivalent hand written loops:
+  Filtered filtered;
+  filtered.vec = shuffled;
+  Filtered::keep keep;
+  bench_iterators("tpl_filter", size, filtered.begin(), filtered.end(), out);
+
+  // (`vec` was sorted above, which would make the branch predictable)
+  const int* data = shuffled.data();
+  report("raw_filter", "sum", size, measure([&] {
+    return timed([&] {
+      long sum = 0;
+      for (std::size_t i = 0; i < size; ++i) if (keep(data[i])) sum += data[i];
+      escape(sum);
+    });
+  }, size));
+  report("raw_filter", "find", size, measure([&] {
+    int needle = missing;
+    return timed([&] {
+      std::size_t i = 0;
+      while (i < size && !(keep(data[i]) && data[i] == needle)) ++i;
+      escape(i);
+    });
+  }, size));
+  report("raw_filter", "copy", size, measure([&] {
+    return timed([&] { escape(std::copy_if(data, data + size, out.begin(), keep)); });
+  }, size));
+}
+
+int main() {
+  std::printf("{\n  \"compiler\": \"%s\",\n  \"flags\": \"%s\",\n  \"results\": [",
+              __VERSION__, BENCH_FLAGS);
+  const std::size_t sizes[] = { 1000, 100000, 1000000 };
+  for (std::size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+    bench_size(sizes[i]);
+  }
+  std::printf("\n  ]\n}\n");
+  return 0;
+}
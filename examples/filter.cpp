@@ -1,4 +1,3 @@
-
 #include <iostream>
 #include <vector>
 
@@ -13,36 +12,26 @@ struct Point {
 struct Shape {
   std::vector<Point> vec;
 
-  static bool some_filter (const Point& p) {
-    return p.x > p.y;
-  }
+  // The iterators will only visit the points for which this returns true:
+  struct some_filter {
+    bool operator()(const Point& p) const {
+      return p.x <= p.y;
+    }
+  };
 
+  // A normal state, the filtering is done by the macro below:
   struct it_state {
     int pos;
-    int end_pos;
-
-    // Find next valid item:
-    inline void next(const Shape* ref) {
-      ++pos;
-      while (some_filter(ref->vec[pos]) && pos < end_pos) ++pos;
-    }
-
-    // Prepare the iterator:
-    inline void begin(const Shape* ref) {
-      pos = -1;
-      end_pos = ref->vec.size();
-      // Find first valid item:
-      next(ref);
-    }
-
+    inline void next(const Shape* ref) { ++pos; }
+    inline void begin(const Shape* ref) { pos = 0; }
     inline void end(const Shape* ref) { pos = ref->vec.size(); }
     inline Point& get(Shape* ref) { return ref->vec[pos]; }
     inline bool equals(const it_state& s) const { return pos == s.pos; }
 
-    // Optional for const_iterator to work:
+    // Required for testing the filter:
     inline const Point& get(const Shape* ref) { return ref->vec[pos]; }
   };
-  SETUP_ITERATORS(Shape, Point&, it_state);
+  SETUP_FILTERED_ITERATORS(Shape, Point&, it_state, some_filter);
 };
 
 int main() {
@@ -0,0 +1,44 @@
+#include <iostream>
+
+#include "../iterator_tpl.h"
+
+// The fields of each point are kept in separate arrays,
+// and iterating yields references to them:
+struct PointRef {
+  int& x;
+  int& y;
+};
+
+struct ConstPointRef {
+  const int& x;
+  const int& y;
+};
+
+typedef iterator_tpl::soa_vector<PointRef, ConstPointRef, int, int> Points;
+
+int main() {
+  Points points;
+  points.push_back(1, 2);
+  points.push_back(2, 3);
+  points.push_back(3, 4);
+
+  for (PointRef p : points) {
+    p.y += p.x;
+  }
+
+  for (Points::const_iterator it = points.begin(); it != points.end(); ++it) {
+    std::cout << it->x << " " << it->y << std::endl;
+    // Output:
+    // 1 3
+    // 2 5
+    // 3 7
+  }
+
+  // Scanning a single field reads only its array:
+  const int* xs = points.column<0>();
+  int sum = 0;
+  for (size_t i = 0; i < points.size(); ++i) sum += xs[i];
+  std::cout << "sum of x: " << sum << std::endl; // 6
+
+  return 0;
+}
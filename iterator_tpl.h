@@ -23,6 +23,69 @@
 #ifndef _iterator_tpl_h_
 #define _iterator_tpl_h_
 
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <iterator>
+
+#if __cplusplus >= 201103L
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#endif
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#if __cplusplus >= 202002L && defined(__cpp_impl_coroutine)
+#define VGSI_COROUTINES 1
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <memory>
+#endif
+
+// Checked iterators detect common bugs, such as using an iterator after
+// its container was modified, comparing iterators of different containers
+// or dereferencing `end()`, at the cost of some speed.
+// They change the layout of the iterators, so they are disabled by default
+// and must be enabled (with `-DVGSI_CHECKED_ITERATORS=1`) on every
+// translation unit of a program, or on none:
+#ifndef VGSI_CHECKED_ITERATORS
+#define VGSI_CHECKED_ITERATORS 0
+#endif
+
+#if defined(_MSC_VER)
+#if VGSI_CHECKED_ITERATORS
+#pragma detect_mismatch("VGSI_CHECKED_ITERATORS", "1")
+#else
+#pragma detect_mismatch("VGSI_CHECKED_ITERATORS", "0")
+#endif
+#endif
+
+// Called when a checked iterator detects an error:
+#ifndef VGSI_ASSERT
+#define VGSI_ASSERT(COND, MSG) assert((COND) && MSG)
+#endif
+
+#if VGSI_CHECKED_ITERATORS
+#define VGSI_CHECK(EXPR) EXPR
+#else
+#define VGSI_CHECK(EXPR)
+#endif
+
+// The default instrumentation level for all iterators, see
+// `iterator_tpl::instrumentation` below:
+#ifndef VGSI_INSTRUMENT_ITERATORS
+#define VGSI_INSTRUMENT_ITERATORS 0
+#endif
+
+// Counts (and optionally times) a call to the state inside the iterators:
+#define VGSI_PROBE(OP) \
+  iterator_tpl::detail::probe<C, S> vgsi_probe(iterator_tpl::detail::OP##_op)
+
 namespace iterator_tpl {
 
 // Use this define to declare both:
@@ -34,28 +97,37 @@ namespace iterator_tpl {
   VGSI_SETUP_CONST_ITERATOR(C, T, S)
 
 // Use this define to declare only `iterator`
-#define VGSI_SETUP_MUTABLE_ITERATOR(C, T, S)         \
-  typedef iterator_tpl::iterator<C, T, S> iterator;  \
-  iterator begin() { return iterator::begin(this); } \
-  iterator end()   { return iterator::end(this);   }
+#define VGSI_SETUP_MUTABLE_ITERATOR(C, T, S)                   \
+  typedef iterator_tpl::iterator<C, T, S> iterator;            \
+  iterator begin() { return iterator::begin(this); }           \
+  VGSI_END_TYPE(C, iterator, S) end() {                        \
+    return iterator_tpl::end_type<C, iterator, S>::make(this); \
+  }
 
 // Use this define to declare only `const_iterator`
-#define VGSI_SETUP_CONST_ITERATOR(C, T, S)                              \
-  typedef iterator_tpl::const_iterator<C, T, S> const_iterator;         \
-  const_iterator begin() const { return const_iterator::begin(this); }  \
-  const_iterator end()   const { return const_iterator::end(this);   }  \
-  const_iterator cbegin() const { return const_iterator::begin(this); } \
-  const_iterator cend()   const { return const_iterator::end(this);   }
+#define VGSI_SETUP_CONST_ITERATOR(C, T, S)                                    \
+  typedef iterator_tpl::const_iterator<C, T, S> const_iterator;               \
+  const_iterator begin() const { return const_iterator::begin(this); }        \
+  VGSI_END_TYPE(const C, const_iterator, S) end() const {                     \
+    return iterator_tpl::end_type<const C, const_iterator, S>::make(this);    \
+  }                                                                           \
+  const_iterator cbegin() const { return const_iterator::begin(this); }       \
+  VGSI_END_TYPE(const C, const_iterator, S) cend() const {                    \
+    return iterator_tpl::end_type<const C, const_iterator, S>::make(this);    \
+  }
+
+// The type returned by `end()`, a `sentinel` if the state provides
+// `at_end()` and the sentinels are supported (C++17), or the iterator:
+#if __cplusplus >= 201703L
+#define VGSI_END_TYPE(C, It, S) typename iterator_tpl::end_type<C, It, S>::type
+#else
+#define VGSI_END_TYPE(C, It, S) It
+#endif
 
 // S should be the state struct used to forward iteration:
-#define VGSI_SETUP_REVERSE_ITERATORS(C, T, S)                       \
-  struct S##_reversed : public S {                                  \
-    inline void next (const C* ref) { S::prev(ref); }               \
-    inline void prev (const C* ref) { S::next(ref); }               \
-    inline void begin(const C* ref) { S::end(ref); S::prev(ref);}   \
-    inline void end  (const C* ref) { S::begin(ref); S::prev(ref);} \
-  };                                                                \
-  VGSI_SETUP_MUTABLE_RITERATOR(C, T, S)                             \
+#define VGSI_SETUP_REVERSE_ITERATORS(C, T, S)                   \
+  typedef iterator_tpl::reverse_state<C, S> S##_reversed;      \
+  VGSI_SETUP_MUTABLE_RITERATOR(C, T, S)                         \
   VGSI_SETUP_CONST_RITERATOR(C, T, S)
 
 #define VGSI_SETUP_MUTABLE_RITERATOR(C, T, S)                           \
@@ -78,6 +150,57 @@ namespace iterator_tpl {
     return const_reverse_iterator::end(this);                                       \
   }
 
+// Declares `iterator` and `const_iterator` visiting only the
+// elements `x` for which `Pred()(x)` returns true:
+#define VGSI_SETUP_FILTERED_ITERATORS(C, T, S, Pred)                \
+  typedef iterator_tpl::filter_state<C, T, S, Pred> S##_filtered;  \
+  VGSI_SETUP_ITERATORS(C, T, S##_filtered)
+
+// Declares `iterator` and `const_iterator` prefetching the element
+// `Distance` steps ahead of the current one on each `next()`:
+#define VGSI_SETUP_PREFETCHING_ITERATORS(C, T, S, Distance)                \
+  typedef iterator_tpl::prefetch_state<C, S, Distance> S##_prefetching;   \
+  VGSI_SETUP_ITERATORS(C, T, S##_prefetching)
+
+#if defined(__GNUC__)
+#define VGSI_PREFETCH(ADDR) __builtin_prefetch(ADDR)
+#else
+#define VGSI_PREFETCH(ADDR) ((void)(ADDR))
+#endif
+
+// Declares `iterator` and `const_iterator` computing the rvalue
+// returned by `get()` at most once per position:
+#define VGSI_SETUP_CACHED_ITERATORS(C, T, S)                   \
+  typedef iterator_tpl::cached_state<C, T, S> S##_cached;     \
+  VGSI_SETUP_ITERATORS(C, T, S##_cached)
+
+// Declares `move_iterator`, `move_begin()` and `move_end()`, yielding
+// rvalue references so the elements can be moved out of C (C++11):
+#define VGSI_SETUP_MOVE_ITERATORS(C, T, S)                                      \
+  typedef std::move_iterator<iterator_tpl::iterator<C, T, S> > move_iterator;  \
+  move_iterator move_begin() {                                                 \
+    return move_iterator(iterator_tpl::iterator<C, T, S>::begin(this));        \
+  }                                                                            \
+  move_iterator move_end() {                                                   \
+    return move_iterator(iterator_tpl::iterator<C, T, S>::end(this));          \
+  }
+
+// Like the move iterators, but calling the `drain()` function of
+// the state instead of `next()`, so it can release each element
+// after it was moved from (C++11):
+#define VGSI_SETUP_DRAIN_ITERATORS(C, T, S)                                    \
+  typedef iterator_tpl::drain_state<C, S> S##_drained;                        \
+  typedef iterator_tpl::drain_move_iterator<                                  \
+    iterator_tpl::iterator<C, T, S##_drained> > drain_iterator;               \
+  drain_iterator drain_begin() {                                              \
+    return drain_iterator(                                                    \
+      iterator_tpl::iterator<C, T, S##_drained>::begin(this));                \
+  }                                                                           \
+  drain_iterator drain_end() {                                                \
+    return drain_iterator(                                                    \
+      iterator_tpl::iterator<C, T, S##_drained>::end(this));                  \
+  }
+
 #define VGSI_STL_TYPEDEFS(T)               \
   typedef std::ptrdiff_t difference_type;  \
   typedef size_t size_type;                \
@@ -113,10 +236,640 @@ namespace iterator_tpl {
 #define SETUP_CONST_RITERATOR(C, T, S) VGSI_SETUP_CONST_RITERATOR(C, T, S)
 #endif
 
+#ifndef SETUP_FILTERED_ITERATORS
+#define SETUP_FILTERED_ITERATORS(C, T, S, Pred) \
+  VGSI_SETUP_FILTERED_ITERATORS(C, T, S, Pred)
+#endif
+
+#ifndef SETUP_PREFETCHING_ITERATORS
+#define SETUP_PREFETCHING_ITERATORS(C, T, S, Distance) \
+  VGSI_SETUP_PREFETCHING_ITERATORS(C, T, S, Distance)
+#endif
+
+#ifndef SETUP_CACHED_ITERATORS
+#define SETUP_CACHED_ITERATORS(C, T, S) VGSI_SETUP_CACHED_ITERATORS(C, T, S)
+#endif
+
+#ifndef SETUP_MOVE_ITERATORS
+#define SETUP_MOVE_ITERATORS(C, T, S) VGSI_SETUP_MOVE_ITERATORS(C, T, S)
+#endif
+
+#ifndef SETUP_DRAIN_ITERATORS
+#define SETUP_DRAIN_ITERATORS(C, T, S) VGSI_SETUP_DRAIN_ITERATORS(C, T, S)
+#endif
+
 #ifndef STL_TYPEDEFS
 #define STL_TYPEDEFS(T) VGSI_STL_TYPEDEFS(T)
 #endif
 
+/* * * * * STATE INTROSPECTION: * * * * */
+
+namespace detail {
+
+template <bool Cond, class A, class B>
+struct if_ { typedef A type; };
+template <class A, class B>
+struct if_<false, A, B> { typedef B type; };
+
+template <bool B>
+struct bool_ { static const bool value = B; };
+
+template <typename T>
+struct remove_const { typedef T type; };
+template <typename T>
+struct remove_const<const T> { typedef T type; };
+
+// Defines `has_<name><S>::value`, true if `S` declares a member
+// called `name` regardless of its signature, so overloaded
+// functions are detected as well (works on C++98):
+#define VGSI_DEFINE_HAS_MEMBER(name)                            \
+  template <class S>                                            \
+  struct has_##name {                                           \
+    struct fallback { int name; };                              \
+    struct derived : S, fallback {};                            \
+    template <typename U, U> struct check;                      \
+    template <class U>                                          \
+    static char (&test(check<int fallback::*, &U::name>*))[1];  \
+    template <class U>                                          \
+    static char (&test(...))[2];                                \
+    static const bool value = sizeof(test<derived>(0)) == 2;    \
+  }
+
+VGSI_DEFINE_HAS_MEMBER(prev);
+VGSI_DEFINE_HAS_MEMBER(advance);
+VGSI_DEFINE_HAS_MEMBER(distance);
+VGSI_DEFINE_HAS_MEMBER(data);
+VGSI_DEFINE_HAS_MEMBER(next_block);
+VGSI_DEFINE_HAS_MEMBER(mask);
+VGSI_DEFINE_HAS_MEMBER(at_end);
+VGSI_DEFINE_HAS_MEMBER(generation);
+VGSI_DEFINE_HAS_MEMBER(for_each);
+VGSI_DEFINE_HAS_MEMBER(single_pass);
+VGSI_DEFINE_HAS_MEMBER(remaining);
+VGSI_DEFINE_HAS_MEMBER(stateless_ref);
+VGSI_DEFINE_HAS_MEMBER(checked_end);
+
+// The strongest iterator category the state `S` can support, states
+// that can only be visited once, such as streams, should declare a
+// member called `single_pass` to be input iterators:
+template <class S>
+struct state_category {
+  static const bool random_access =
+    has_advance<S>::value && has_distance<S>::value;
+  static const bool contiguous = random_access && has_data<S>::value;
+
+  typedef typename if_<has_single_pass<S>::value,
+    std::input_iterator_tag,
+    typename if_<random_access,
+      std::random_access_iterator_tag,
+      typename if_<has_prev<S>::value,
+        std::bidirectional_iterator_tag,
+        std::forward_iterator_tag
+      >::type
+    >::type
+  >::type type;
+};
+
+// Input iterators share their position with their copies:
+template <class Tag>
+struct is_input : bool_<false> {};
+template <>
+struct is_input<std::input_iterator_tag> : bool_<true> {};
+
+// Address of the current element:
+template <class P, class S, class R>
+inline P address(S& state, R* ref, bool_<true>) { return state.data(ref); }
+template <class P, class S, class R>
+inline P address(S& state, R* ref, bool_<false>) { return &state.get(ref); }
+
+}  // namespace detail
+
+/* * * * * REVERSE STATE ADAPTOR: * * * * */
+
+// Used by `VGSI_SETUP_REVERSE_ITERATORS` to walk `S` backwards.
+// It is a template so that the optional functions below
+// are only required when actually used:
+template <class C, class S>
+struct reverse_state : public S {
+  inline void next (const C* ref) { S::prev(ref); }
+  inline void prev (const C* ref) { S::next(ref); }
+  inline void begin(const C* ref) { S::end(ref); S::prev(ref);}
+  inline void end  (const C* ref) { S::begin(ref); S::prev(ref);}
+
+  // Optional functions for random access:
+  inline void advance(const C* ref, std::ptrdiff_t n) { S::advance(ref, -n); }
+  inline std::ptrdiff_t distance(const C* ref, const S& s) const {
+    return -S::distance(ref, s);
+  }
+};
+
+namespace detail {
+
+// `reverse_state` declares the random access functions even
+// when `S` doesn't provide them, so ask `S` instead:
+template <class C, class S>
+struct has_advance<reverse_state<C, S> > : has_advance<S> {};
+template <class C, class S>
+struct has_distance<reverse_state<C, S> > : has_distance<S> {};
+// And it is never contiguous:
+template <class C, class S>
+struct has_data<reverse_state<C, S> > : bool_<false> {};
+template <class C, class S>
+struct has_next_block<reverse_state<C, S> > : bool_<false> {};
+template <class C, class S>
+struct has_at_end<reverse_state<C, S> > : bool_<false> {};
+template <class C, class S>
+struct has_for_each<reverse_state<C, S> > : bool_<false> {};
+template <class C, class S>
+struct has_remaining<reverse_state<C, S> > : bool_<false> {};
+
+}  // namespace detail
+
+/* * * * * ARROW PROXY: * * * * */
+
+// Returned by `operator->()` of the iterators to rvalues,
+// keeping the value alive while its members are accessed:
+template <typename T>
+struct arrow_proxy {
+  T value;
+  T* operator->() { return &value; }
+};
+
+/* * * * * BLOCKS: * * * * */
+
+// A contiguous span of elements, as returned by the
+// optional `next_block()` function of the state:
+template <typename T>
+struct block {
+  T* data;
+  std::size_t size;
+};
+
+template <typename T>
+inline block<T> make_block(T* data, std::size_t size) {
+  block<T> b = { data, size };
+  return b;
+}
+
+/* * * * * POSTFIX PROXY: * * * * */
+
+// Returned by the postfix `operator++` of input iterators instead of a
+// copy, since the copy would share the position of the incremented
+// iterator. It keeps the value of the element it left, so `*it++`
+// returns the same element as `*it` did, like `std::istreambuf_iterator`:
+template <typename T>
+struct postfix_proxy {
+  T value;
+  template <class It>
+  explicit postfix_proxy(const It& it) : value(*it) {}
+  T& operator*() { return value; }
+  T* operator->() { return &value; }
+};
+
+// The blocks of input iterators, such as the records of a stream,
+// may point to a buffer reused by the next element, so keep a copy:
+template <typename T>
+struct postfix_proxy<block<T> > {
+ private:
+  typedef typename detail::remove_const<T>::type V;
+  V* copy;
+  block<T> value;
+
+  void assign(block<T> b) {
+    copy = new V[b.size];
+    std::copy(b.data, b.data + b.size, copy);
+    value = make_block<T>(b.data ? copy : 0, b.size);
+  }
+
+ public:
+  template <class It>
+  explicit postfix_proxy(const It& it) { assign(*it); }
+  postfix_proxy(const postfix_proxy& other) { assign(other.value); }
+  postfix_proxy& operator=(const postfix_proxy& other) {
+    if (this != &other) {
+      V* old = copy;
+      assign(other.value);
+      delete[] old;
+    }
+    return *this;
+  }
+  ~postfix_proxy() { delete[] copy; }
+
+  block<T>& operator*() { return value; }
+  block<T>* operator->() { return &value; }
+};
+
+/* * * * * CHECKED ITERATORS: * * * * */
+
+#if VGSI_CHECKED_ITERATORS
+namespace detail {
+
+template <class S, class R>
+inline std::size_t generation(const S& s, R* ref, bool_<true>) {
+  return s.generation(ref);
+}
+template <class S, class R>
+inline std::size_t generation(const S&, R*, bool_<false>) { return 0; }
+
+// Uses the optional `generation()` function of the state, which should
+// return a counter incremented by the container every time its iterators
+// are invalidated:
+template <class S, class R>
+inline std::size_t generation(const S& s, R* ref) {
+  return generation(s, ref, bool_<has_generation<S>::value>());
+}
+
+template <class It>
+inline void init_checks(It& it) { it.generation = generation(it.state, it.ref); }
+
+template <class It>
+inline void check_valid(const It& it) {
+  VGSI_ASSERT(it.generation == generation(it.state, it.ref),
+              "iterator used after its container was modified");
+}
+
+// Building an end state may be expensive (e.g. pinning an epoch or
+// measuring the container), so `end()` is only detected with `at_end()`,
+// or if the state declares a member called `checked_end`:
+template <class It, class B>
+inline bool is_end(const It& it, bool_<true>, B) { return it.state.at_end(it.ref); }
+template <class It>
+inline bool is_end(const It& it, bool_<false>, bool_<true>) {
+  It last = it;
+  last.end();
+  return it.equals(last.state);
+}
+template <class It>
+inline bool is_end(const It&, bool_<false>, bool_<false>) { return false; }
+
+template <class It, class S>
+inline void check_not_end(const It& it, const S&) {
+  VGSI_ASSERT(!is_end(it, bool_<has_at_end<S>::value>(),
+                      bool_<has_checked_end<S>::value>()),
+              "dereferencing or incrementing end()");
+}
+
+template <class It>
+inline void check_dereferenceable(const It& it) {
+  check_valid(it);
+  check_not_end(it, it.state);
+}
+
+template <class It1, class It2>
+inline void check_comparable(const It1& a, const It2& b) {
+  VGSI_ASSERT(a.ref == b.ref, "comparing iterators of different containers");
+  check_valid(a);
+  check_valid(b);
+}
+
+}  // namespace detail
+#endif
+
+/* * * * * INSTRUMENTATION: * * * * */
+
+// Instrumentation levels (requires C++11 and `iterator_tpl_instrument.h`):
+// - `no_instrumentation`: all the probes are removed by the compiler.
+// - `count_calls`: counts the calls to each function of the state.
+// - `count_cycles`: also measures the CPU cycles of 1 in every
+//   `cycles_sample_rate` calls (with `rdtsc` on x86, or nanoseconds elsewhere).
+enum { no_instrumentation = 0, count_calls = 1, count_cycles = 2 };
+enum { cycles_sample_rate = 64 };
+
+// Specialize this template to instrument only the iterators using the state `S`:
+//
+//   namespace iterator_tpl {
+//   template <>
+//   struct instrumentation<myClass::it_state> {
+//     static const int level = count_calls;
+//   };
+//   }
+template <class S>
+struct instrumentation {
+  static const int level = VGSI_INSTRUMENT_ITERATORS;
+};
+
+namespace detail {
+
+enum probe_op {
+  next_op, prev_op, get_op, equals_op, advance_op, distance_op, at_end_op,
+  probe_op_count
+};
+
+// The instrumented probes are defined in `iterator_tpl_instrument.h`:
+template <class C, class S, int Level = instrumentation<S>::level>
+struct probe;
+
+template <class C, class S>
+struct probe<C, S, no_instrumentation> {
+  explicit probe(probe_op) {}
+};
+
+}  // namespace detail
+
+
+/* * * * * SENTINELS: * * * * */
+
+// Returned by `end()` instead of an iterator when the state provides
+// `at_end()`, so loops only need to test `it.at_end()` instead of
+// building an end state and comparing it with the current one.
+//
+// It converts to a normal iterator for functions that need one:
+template <class C, class It>
+struct sentinel {
+  C* ref;
+
+  operator It() const { return It::end(ref); }
+
+  friend bool operator==(const It& it, const sentinel& s) { return s == it; }
+  friend bool operator!=(const It& it, const sentinel& s) { return !(s == it); }
+  friend bool operator!=(const sentinel& s, const It& it) { return !(s == it); }
+  friend bool operator==(const sentinel& s, const It& it) {
+    VGSI_CHECK(VGSI_ASSERT(s.ref == it.ref, "comparing iterators of different containers"));
+    VGSI_CHECK(detail::check_valid(it));
+    return it.at_end();
+  }
+};
+
+template <class C, class It, class S,
+          bool UseSentinel = detail::has_at_end<S>::value &&
+                             __cplusplus >= 201703L>
+struct end_type {
+  typedef It type;
+  static It make(C* ref) { return It::end(ref); }
+};
+
+template <class C, class It, class S>
+struct end_type<C, It, S, true> {
+  typedef sentinel<C, It> type;
+  static type make(C* ref) { type s = { ref }; return s; }
+};
+
+/* * * * * FILTER STATE ADAPTOR: * * * * */
+
+namespace detail {
+
+// The type returned by the const version of `get()`:
+template <typename T>
+struct const_value { typedef T type; };
+template <typename T>
+struct const_value<T&> { typedef const T& type; };
+
+#if __cplusplus >= 201103L
+inline int count_trailing_zeros(unsigned long long mask) {
+#if defined(__GNUC__)
+  return __builtin_ctzll(mask);
+#else
+  int n = 0;
+  while ((mask & 1) == 0) { mask >>= 1; ++n; }
+  return n;
+#endif
+}
+#endif
+
+}  // namespace detail
+
+#if __cplusplus >= 201103L
+// Returns a bitmask with the bit `i` set if `pred(data[i])` is true,
+// for `size <= 64`. The loop has no branches, so the compiler can
+// vectorize it, making it a good default for `Pred::mask()`:
+template <typename V, class F>
+inline unsigned long long batch_mask(const V* data, std::size_t size, F pred) {
+  unsigned long long mask = 0;
+  for (std::size_t i = 0; i < size; ++i) {
+    mask |= static_cast<unsigned long long>(pred(data[i]) ? 1 : 0) << i;
+  }
+  return mask;
+}
+#endif
+
+// Used by `VGSI_SETUP_FILTERED_ITERATORS` to skip the
+// elements of `S` for which `Pred()(x)` returns false.
+//
+// This version tests one element at a time:
+template <class C, typename T, class S, class Pred
+#if __cplusplus >= 201103L
+  , bool Batched = detail::has_mask<Pred>::value &&
+                   detail::state_category<S>::contiguous
+#endif
+>
+struct filter_state {
+  S state;
+  // The end of the range, so `next()` never goes past it:
+  S last;
+
+  inline void next(const C* ref) { state.next(ref); skip(ref); }
+  inline void begin(const C* ref) { state.begin(ref); last.end(ref); skip(ref); }
+  inline void end(const C* ref) { state.end(ref); }
+  inline T get(C* ref) { return state.get(ref); }
+  inline typename detail::const_value<T>::type get(const C* ref) {
+    return state.get(ref);
+  }
+  inline bool equals(const filter_state& s) const { return state.equals(s.state); }
+
+ private:
+  // Find next valid item:
+  inline void skip(const C* ref) {
+    while (!state.equals(last) && !Pred()(state.get(ref))) state.next(ref);
+  }
+};
+
+#if __cplusplus >= 201103L
+// This version is used when `S` is contiguous and `Pred` provides
+// `unsigned long long mask(const V* data, std::size_t size)`,
+// returning the results of the predicate for up to 64 elements as a
+// bitmask, so it can jump directly between the selected elements:
+template <class C, typename T, class S, class Pred>
+struct filter_state<C, T, S, Pred, true> {
+  S state;
+  S last;
+  // The results for the next `remaining` elements, starting at `state`:
+  unsigned long long selected;
+  std::ptrdiff_t remaining;
+
+  inline void next(const C* ref) {
+    state.advance(ref, 1);
+    selected >>= 1;
+    --remaining;
+    skip(ref);
+  }
+  inline void begin(const C* ref) {
+    state.begin(ref);
+    last.end(ref);
+    selected = 0;
+    remaining = 0;
+    skip(ref);
+  }
+  inline void end(const C* ref) { state.end(ref); selected = 0; remaining = 0; }
+  inline T get(C* ref) { return state.get(ref); }
+  inline typename detail::const_value<T>::type get(const C* ref) {
+    return state.get(ref);
+  }
+  inline bool equals(const filter_state& s) const { return state.equals(s.state); }
+
+ private:
+  inline void skip(const C* ref) {
+    while (selected == 0) {
+      state.advance(ref, remaining);
+      std::ptrdiff_t left = -state.distance(ref, last);
+      if (left == 0) {
+        remaining = 0;
+        return;
+      }
+      remaining = left < 64 ? left : 64;
+      selected = Pred().mask(state.data(ref), remaining);
+    }
+    int skipped = detail::count_trailing_zeros(selected);
+    state.advance(ref, skipped);
+    selected >>= skipped;
+    remaining -= skipped;
+  }
+};
+#endif
+
+/* * * * * PREFETCH STATE ADAPTOR: * * * * */
+
+// Used by `VGSI_SETUP_PREFETCHING_ITERATORS` for states whose elements
+// are scattered in memory, e.g. a vector of pointers or a hash table.
+// `S` must provide `prefetch_address(ref, k)` returning the address of
+// the element `k` steps ahead of the current one (or null if it doesn't
+// know it) without reading the elements in between, so the cache misses
+// of several elements overlap instead of being paid one after the other.
+template <class C, class S, int Distance = 4>
+struct prefetch_state : public S {
+  inline void next(const C* ref) {
+    VGSI_PREFETCH(S::prefetch_address(ref, Distance));
+    S::next(ref);
+  }
+};
+
+/* * * * * CACHED STATE ADAPTOR: * * * * */
+
+// Used by `VGSI_SETUP_CACHED_ITERATORS` for states whose `get()` computes
+// an rvalue, keeping it until the state moves to another position, so
+// algorithms that dereference the same iterator several times don't
+// compute it again. `T` must be default constructible and assignable.
+template <class C, typename T, class S>
+struct cached_state : public S {
+  mutable T value;
+  mutable bool cached;
+
+  cached_state() : cached(false) {}
+
+  inline void next (const C* ref) { S::next(ref);  cached = false; }
+  inline void prev (const C* ref) { S::prev(ref);  cached = false; }
+  inline void begin(const C* ref) { S::begin(ref); cached = false; }
+  inline void end  (const C* ref) { S::end(ref);   cached = false; }
+  inline void advance(const C* ref, std::ptrdiff_t n) {
+    S::advance(ref, n);
+    cached = false;
+  }
+
+  template <class R>
+  inline const T& get(R* ref) const {
+    if (!cached) {
+      value = const_cast<cached_state*>(this)->S::get(ref);
+      cached = true;
+    }
+    return value;
+  }
+};
+
+namespace detail {
+
+// `cached_state` declares `prev()` and `advance()` even
+// when `S` doesn't provide them, so ask `S` instead:
+template <class C, typename T, class S>
+struct has_prev<cached_state<C, T, S> > : has_prev<S> {};
+template <class C, typename T, class S>
+struct has_advance<cached_state<C, T, S> > : has_advance<S> {};
+
+}  // namespace detail
+
+/* * * * * DRAIN STATE ADAPTOR: * * * * */
+
+// Used by `VGSI_SETUP_DRAIN_ITERATORS`. The state should provide
+// `void drain(C* ref)`, releasing the current element and moving to
+// the next one, e.g. deleting the current node of a linked list.
+// The drained range can only be visited once, from begin to end:
+template <class C, class S>
+struct drain_state : public S {
+  inline void next(C* ref) { S::drain(ref); }
+};
+
+namespace detail {
+
+// Algorithms must not assume it can be visited more than once:
+template <class C, class S>
+struct state_category<drain_state<C, S> > {
+  static const bool random_access = false;
+  static const bool contiguous = false;
+  typedef std::input_iterator_tag type;
+};
+
+template <class C, class S>
+struct has_next_block<drain_state<C, S> > : bool_<false> {};
+template <class C, class S>
+struct has_for_each<drain_state<C, S> > : bool_<false> {};
+
+}  // namespace detail
+
+#if __cplusplus >= 201103L
+// The `drain_iterator` declared by `VGSI_SETUP_DRAIN_ITERATORS`. Before
+// C++20 the postfix `operator++` of `std::move_iterator` returns a copy
+// pointing to the element just released, so this one moves the element
+// to a `postfix_proxy` before draining it:
+template <class It>
+struct drain_move_iterator : std::move_iterator<It> {
+  typedef typename std::move_iterator<It>::value_type value_type;
+
+  drain_move_iterator() {}
+  explicit drain_move_iterator(It it) : std::move_iterator<It>(it) {}
+
+  drain_move_iterator& operator++() {
+    std::move_iterator<It>::operator++();
+    return *this;
+  }
+  postfix_proxy<value_type> operator++(int) {
+    postfix_proxy<value_type> temp(*this);
+    ++*this;
+    return temp;
+  }
+};
+#endif
+
+namespace detail {
+
+// True unless the state declares `static const bool stateless_ref = true;`,
+// meaning its functions don't use `ref` except for `begin()` and `end()`,
+// so the other functions receive a null `ref`:
+// (checked iterators always keep it, to validate the iterators)
+template <class S, bool = has_stateless_ref<S>::value && !VGSI_CHECKED_ITERATORS>
+struct stores_ref : bool_<true> {};
+template <class S>
+struct stores_ref<S, true> : bool_<!S::stateless_ref> {};
+
+// The container pointer of the iterators:
+template <class C, bool Stored>
+struct ref_storage {
+  C* ref;
+  ref_storage() {}
+  explicit ref_storage(C* ref) : ref(ref) {}
+  void set_ref(C* r) { ref = r; }
+};
+
+// Takes no space, so an iterator over a pointer-sized state is pointer-sized:
+template <class C>
+struct ref_storage<C, false> {
+  static C* const ref;
+  ref_storage() {}
+  explicit ref_storage(C*) {}
+  void set_ref(C*) {}
+};
+template <class C>
+C* const ref_storage<C, false>::ref = 0;
+
+}  // namespace detail
+
 // Forward declaration of const_iterator:
 template <class C, typename T, class S>
 struct const_iterator;
@@ -128,43 +881,81 @@ struct const_iterator;
 // S - The state keeping structure
 template <class C, typename T, class S>
 // The non-specialized version is used for T=rvalue:
-struct iterator {
-  // Keeps a reference to the container:
-  C* ref;
+struct iterator : detail::ref_storage<C, detail::stores_ref<S>::value> {
+  // STL iterator traits:
+  typedef typename detail::state_category<S>::type iterator_category;
+  typedef std::ptrdiff_t difference_type;
+  typedef T value_type;
+  typedef T reference;
+  typedef arrow_proxy<T> pointer;
+  // Returned by the postfix `operator++`, see `postfix_proxy`:
+  typedef typename detail::if_<detail::is_input<iterator_category>::value,
+    postfix_proxy<value_type>, iterator>::type postfix_type;
+
+  // Keeps a reference to the container, unless the state doesn't use it:
+  typedef detail::ref_storage<C, detail::stores_ref<S>::value> ref_storage;
+  using ref_storage::ref;
 
   // User defined struct to describe the iterator state:
   // This struct should provide the functions listed below,
   // however, note that some of them are optional
   S state;
 
+#if VGSI_CHECKED_ITERATORS
+  // The container generation when the iterator was created,
+  // see the optional `generation()` function of the state:
+  std::size_t generation;
+#endif
+
   // Set iterator to next() state:
-  void next()  { state.next(ref);  }
+  void next()  { VGSI_PROBE(next); state.next(ref); }
   // Initialize iterator to first state:
   void begin() { state.begin(ref); }
   // Initialize iterator to end state:
   void end()   { state.end(ref);   }
   // Returns current `value`
-  T get() { return state.get(ref); }
+  // (iterators are const like pointers are, i.e. their constness
+  // doesn't propagate to the container or to the state)
+  T get() const {
+    VGSI_PROBE(get);
+    return const_cast<S&>(state).get(ref);
+  }
   // Return true if `state != s`:
-  bool equals(const S& s) const { return state.equals(s); }
+  bool equals(const S& s) const { VGSI_PROBE(equals); return state.equals(s); }
 
   // Optional function for reverse iteration:
-  void prev() { state.prev(ref); }
+  void prev() { VGSI_PROBE(prev); state.prev(ref); }
+
+  // Optional function for sentinels:
+  bool at_end() const { VGSI_PROBE(at_end); return state.at_end(ref); }
+
+  // Optional function for sized ranges, the number of elements
+  // from the current one to the end:
+  difference_type remaining() const { return state.remaining(ref); }
+
+  // Optional functions for random access:
+  void advance(difference_type n) { VGSI_PROBE(advance); state.advance(ref, n); }
+  difference_type distance(const S& s) const {
+    VGSI_PROBE(distance);
+    return state.distance(ref, s);
+  }
 
  public:
   static iterator begin(C* ref) {
     iterator it(ref);
-    it.begin();
+    it.state.begin(ref);
+    VGSI_CHECK(detail::init_checks(it));
     return it;
   }
   static iterator end(C* ref) {
     iterator it(ref);
-    it.end();
+    it.state.end(ref);
+    VGSI_CHECK(detail::init_checks(it));
     return it;
   }
 
  protected:
-  iterator(C* ref) : ref(ref) {}
+  iterator(C* ref) : ref_storage(ref) {}
 
  public:
   // Note: Instances build with this constructor should
@@ -172,68 +963,166 @@ struct iterator {
   iterator() {}
 
  public:
-  T operator*() { return get(); }
-  iterator& operator++() { next(); return *this; }
-  iterator operator++(int) { iterator temp(*this); next(); return temp; }
-  iterator& operator--() { prev(); return *this; }
-  iterator operator--(int) { iterator temp(*this); prev(); return temp; }
+  T operator*() const {
+    VGSI_CHECK(detail::check_dereferenceable(*this));
+    return get();
+  }
+  arrow_proxy<T> operator->() const {
+    VGSI_CHECK(detail::check_dereferenceable(*this));
+    arrow_proxy<T> p = { get() };
+    return p;
+  }
+  iterator& operator++() {
+    VGSI_CHECK(detail::check_dereferenceable(*this));
+    next();
+    return *this;
+  }
+  postfix_type operator++(int) { postfix_type temp(*this); ++*this; return temp; }
+  iterator& operator--() {
+    VGSI_CHECK(detail::check_valid(*this));
+    prev();
+    return *this;
+  }
+  iterator operator--(int) { iterator temp(*this); --*this; return temp; }
   bool operator!=(const iterator& other) const {
-    return ref != other.ref || !equals(other.state);
+    VGSI_CHECK(detail::check_comparable(*this, other));
+    return !equals(other.state);
   }
   bool operator==(const iterator& other) const {
     return !operator!=(other);
   }
 
-  friend struct iterator_tpl::const_iterator<C,T,S>;
+  // Random access operators (require `advance()` and `distance()`):
+  iterator& operator+=(difference_type n) {
+    VGSI_CHECK(detail::check_valid(*this));
+    advance(n);
+    return *this;
+  }
+  iterator& operator-=(difference_type n) { return *this += -n; }
+  iterator operator+(difference_type n) const { iterator temp(*this); return temp += n; }
+  iterator operator-(difference_type n) const { iterator temp(*this); return temp -= n; }
+  friend iterator operator+(difference_type n, const iterator& it) { return it + n; }
+  difference_type operator-(const iterator& other) const {
+    VGSI_CHECK(detail::check_comparable(*this, other));
+    return distance(other.state);
+  }
+  T operator[](difference_type n) const { return *(*this + n); }
+  bool operator< (const iterator& other) const { return *this - other < 0; }
+  bool operator> (const iterator& other) const { return *this - other > 0; }
+  bool operator<=(const iterator& other) const { return *this - other <= 0; }
+  bool operator>=(const iterator& other) const { return *this - other >= 0; }
+
+  template <class, typename, class>
+  friend struct iterator_tpl::const_iterator;
 
-  // Comparisons between const and normal iterators:
-  bool operator!=(const const_iterator<C,T,S>& other) const {
-    return ref != other.ref || !equals(other.state);
+  // Comparisons between const and normal iterators, `U` may differ from
+  // `T` when the const iterator returns another type, e.g. a proxy:
+  template <typename U>
+  bool operator!=(const const_iterator<C,U,S>& other) const {
+    VGSI_CHECK(detail::check_comparable(*this, other));
+    return !equals(other.state);
   }
-  bool operator==(const const_iterator<C,T,S>& other) const {
+  template <typename U>
+  bool operator==(const const_iterator<C,U,S>& other) const {
     return !operator!=(other);
   }
 };
 
 template <class C, typename T, class S>
 // This specialization is used for iterators to reference types:
-struct iterator<C,T&,S> {
-  // Keeps a reference to the container:
-  C* ref;
+struct iterator<C,T&,S> : detail::ref_storage<C, detail::stores_ref<S>::value> {
+  // STL iterator traits:
+  typedef typename detail::state_category<S>::type iterator_category;
+  typedef std::ptrdiff_t difference_type;
+  typedef T value_type;
+  typedef T& reference;
+  typedef T* pointer;
+  // Returned by the postfix `operator++`, see `postfix_proxy`:
+  typedef typename detail::if_<detail::is_input<iterator_category>::value,
+    postfix_proxy<value_type>, iterator>::type postfix_type;
+#if __cplusplus >= 202002L
+  typedef typename detail::if_<detail::state_category<S>::contiguous,
+    std::contiguous_iterator_tag, iterator_category>::type iterator_concept;
+#endif
+
+  // Keeps a reference to the container, unless the state doesn't use it:
+  typedef detail::ref_storage<C, detail::stores_ref<S>::value> ref_storage;
+  using ref_storage::ref;
 
   // User defined struct to describe the iterator state:
   // This struct should provide the functions listed below,
   // however, note that some of them are optional
   S state;
 
+#if VGSI_CHECKED_ITERATORS
+  // The container generation when the iterator was created,
+  // see the optional `generation()` function of the state:
+  std::size_t generation;
+#endif
+
   // Set iterator to next() state:
-  void next()  { state.next(ref);  }
+  void next()  { VGSI_PROBE(next); state.next(ref); }
   // Initialize iterator to first state:
   void begin() { state.begin(ref); }
   // Initialize iterator to end state:
   void end()   { state.end(ref);   }
   // Returns current `value`
-  T& get() { return state.get(ref); }
+  // (iterators are const like pointers are, i.e. their constness
+  // doesn't propagate to the container or to the state)
+  T& get() const {
+    VGSI_PROBE(get);
+    return const_cast<S&>(state).get(ref);
+  }
   // Return true if `state != s`:
-  bool equals(const S& s) const { return state.equals(s); }
+  bool equals(const S& s) const { VGSI_PROBE(equals); return state.equals(s); }
 
   // Optional function for reverse iteration:
-  void prev() { state.prev(ref); }
+  void prev() { VGSI_PROBE(prev); state.prev(ref); }
+
+  // Optional function for sentinels:
+  bool at_end() const { VGSI_PROBE(at_end); return state.at_end(ref); }
+
+  // Optional function for sized ranges, the number of elements
+  // from the current one to the end:
+  difference_type remaining() const { return state.remaining(ref); }
+
+  // Optional functions for random access:
+  void advance(difference_type n) { VGSI_PROBE(advance); state.advance(ref, n); }
+  difference_type distance(const S& s) const {
+    VGSI_PROBE(distance);
+    return state.distance(ref, s);
+  }
+
+  // Optional function for contiguous storage, returns
+  // the address of the current element (even for `end()`):
+  T* data() const { return const_cast<S&>(state).data(ref); }
+
+  // Optional function for block iteration, returns the contiguous
+  // elements starting at the current one and moves past them:
+  block<T> next_block() { return state.next_block(ref); }
+
+  // Uses `data()` when available since it is also valid for `end()`:
+  T* address() const {
+    return detail::address<T*>(const_cast<S&>(state), ref,
+      detail::bool_<detail::has_data<S>::value>());
+  }
 
  public:
   static iterator begin(C* ref) {
     iterator it(ref);
-    it.begin();
+    it.state.begin(ref);
+    VGSI_CHECK(detail::init_checks(it));
     return it;
   }
   static iterator end(C* ref) {
     iterator it(ref);
-    it.end();
+    it.state.end(ref);
+    VGSI_CHECK(detail::init_checks(it));
     return it;
   }
 
  protected:
-  iterator(C* ref) : ref(ref) {}
+  iterator(C* ref) : ref_storage(ref) {}
 
  public:
   // Note: Instances build with this constructor should
@@ -241,24 +1130,60 @@ struct iterator<C,T&,S> {
   iterator() {}
 
  public:
-  T& operator*()  { return  get(); }
-  T* operator->() { return &get(); }
-  iterator& operator++() { next(); return *this; }
-  iterator operator++(int) { iterator temp(*this); next(); return temp; }
-  iterator& operator--() { prev(); return *this; }
-  iterator operator--(int) { iterator temp(*this); prev(); return temp; }
+  T& operator*() const {
+    VGSI_CHECK(detail::check_dereferenceable(*this));
+    return get();
+  }
+  T* operator->() const {
+    VGSI_CHECK(detail::check_valid(*this));
+    return address();
+  }
+  iterator& operator++() {
+    VGSI_CHECK(detail::check_dereferenceable(*this));
+    next();
+    return *this;
+  }
+  postfix_type operator++(int) { postfix_type temp(*this); ++*this; return temp; }
+  iterator& operator--() {
+    VGSI_CHECK(detail::check_valid(*this));
+    prev();
+    return *this;
+  }
+  iterator operator--(int) { iterator temp(*this); --*this; return temp; }
   bool operator!=(const iterator& other) const {
-    return ref != other.ref || !equals(other.state);
+    VGSI_CHECK(detail::check_comparable(*this, other));
+    return !equals(other.state);
   }
   bool operator==(const iterator& other) const {
     return !operator!=(other);
   }
 
+  // Random access operators (require `advance()` and `distance()`):
+  iterator& operator+=(difference_type n) {
+    VGSI_CHECK(detail::check_valid(*this));
+    advance(n);
+    return *this;
+  }
+  iterator& operator-=(difference_type n) { return *this += -n; }
+  iterator operator+(difference_type n) const { iterator temp(*this); return temp += n; }
+  iterator operator-(difference_type n) const { iterator temp(*this); return temp -= n; }
+  friend iterator operator+(difference_type n, const iterator& it) { return it + n; }
+  difference_type operator-(const iterator& other) const {
+    VGSI_CHECK(detail::check_comparable(*this, other));
+    return distance(other.state);
+  }
+  T& operator[](difference_type n) const { return *(*this + n); }
+  bool operator< (const iterator& other) const { return *this - other < 0; }
+  bool operator> (const iterator& other) const { return *this - other > 0; }
+  bool operator<=(const iterator& other) const { return *this - other <= 0; }
+  bool operator>=(const iterator& other) const { return *this - other >= 0; }
+
   friend struct iterator_tpl::const_iterator<C,T&,S>;
 
   // Comparisons between const and normal iterators:
   bool operator!=(const const_iterator<C,T&,S>& other) const {
-    return ref != other.ref || !equals(other.state);
+    VGSI_CHECK(detail::check_comparable(*this, other));
+    return !equals(other.state);
   }
   bool operator==(const const_iterator<C,T&,S>& other) const {
     return !operator!=(other);
@@ -272,43 +1197,81 @@ struct iterator<C,T&,S> {
 // S - The state keeping structure
 template <class C, typename T, class S>
 // The non-specialized version is used for T=rvalue:
-struct const_iterator {
-  // Keeps a reference to the container:
-  const C* ref;
+struct const_iterator : detail::ref_storage<const C, detail::stores_ref<S>::value> {
+  // STL iterator traits:
+  typedef typename detail::state_category<S>::type iterator_category;
+  typedef std::ptrdiff_t difference_type;
+  typedef T value_type;
+  typedef const T reference;
+  typedef arrow_proxy<const T> pointer;
+  // Returned by the postfix `operator++`, see `postfix_proxy`:
+  typedef typename detail::if_<detail::is_input<iterator_category>::value,
+    postfix_proxy<value_type>, const_iterator>::type postfix_type;
+
+  // Keeps a reference to the container, unless the state doesn't use it:
+  typedef detail::ref_storage<const C, detail::stores_ref<S>::value> ref_storage;
+  using ref_storage::ref;
 
   // User defined struct to describe the iterator state:
   // This struct should provide the functions listed below,
   // however, note that some of them are optional
   S state;
 
+#if VGSI_CHECKED_ITERATORS
+  // The container generation when the iterator was created,
+  // see the optional `generation()` function of the state:
+  std::size_t generation;
+#endif
+
   // Set iterator to next() state:
-  void next()  { state.next(ref);  }
+  void next()  { VGSI_PROBE(next); state.next(ref); }
   // Initialize iterator to first state:
   void begin() { state.begin(ref); }
   // Initialize iterator to end state:
   void end()   { state.end(ref);   }
   // Returns current `value`
-  const T get() { return state.get(ref); }
+  // (iterators are const like pointers are, i.e. their constness
+  // doesn't propagate to the container or to the state)
+  const T get() const {
+    VGSI_PROBE(get);
+    return const_cast<S&>(state).get(ref);
+  }
   // Return true if `state != s`:
-  bool equals(const S& s) const { return state.equals(s); }
+  bool equals(const S& s) const { VGSI_PROBE(equals); return state.equals(s); }
 
   // Optional function for reverse iteration:
-  void prev() { state.prev(ref); }
+  void prev() { VGSI_PROBE(prev); state.prev(ref); }
+
+  // Optional function for sentinels:
+  bool at_end() const { VGSI_PROBE(at_end); return state.at_end(ref); }
+
+  // Optional function for sized ranges, the number of elements
+  // from the current one to the end:
+  difference_type remaining() const { return state.remaining(ref); }
+
+  // Optional functions for random access:
+  void advance(difference_type n) { VGSI_PROBE(advance); state.advance(ref, n); }
+  difference_type distance(const S& s) const {
+    VGSI_PROBE(distance);
+    return state.distance(ref, s);
+  }
 
  public:
   static const_iterator begin(const C* ref) {
     const_iterator it(ref);
-    it.begin();
+    it.state.begin(ref);
+    VGSI_CHECK(detail::init_checks(it));
     return it;
   }
   static const_iterator end(const C* ref) {
     const_iterator it(ref);
-    it.end();
+    it.state.end(ref);
+    VGSI_CHECK(detail::init_checks(it));
     return it;
   }
 
  protected:
-  const_iterator(const C* ref) : ref(ref) {}
+  const_iterator(const C* ref) : ref_storage(ref) {}
 
  public:
   // Note: Instances build with this constructor should
@@ -316,78 +1279,181 @@ struct const_iterator {
   const_iterator() {}
 
   // To make possible copy-construct non-const iterators:
-  const_iterator(const iterator<C,T,S>& other) : ref(other.ref) {
+  template <typename U>
+  const_iterator(const iterator<C,U,S>& other) : ref_storage(other.ref) {
     state = other.state;
+    VGSI_CHECK(generation = other.generation);
   }
 
  public:
-  const T operator*() { return get(); }
-  const_iterator& operator++() { next(); return *this; }
-  const_iterator operator++(int) { const_iterator temp(*this); next(); return temp;  }
-  const_iterator& operator--() { prev(); return *this; }
-  const_iterator operator--(int) { const_iterator temp(*this); prev(); return temp;  }
+  const T operator*() const {
+    VGSI_CHECK(detail::check_dereferenceable(*this));
+    return get();
+  }
+  arrow_proxy<const T> operator->() const {
+    VGSI_CHECK(detail::check_dereferenceable(*this));
+    arrow_proxy<const T> p = { get() };
+    return p;
+  }
+  const_iterator& operator++() {
+    VGSI_CHECK(detail::check_dereferenceable(*this));
+    next();
+    return *this;
+  }
+  postfix_type operator++(int) { postfix_type temp(*this); ++*this; return temp; }
+  const_iterator& operator--() {
+    VGSI_CHECK(detail::check_valid(*this));
+    prev();
+    return *this;
+  }
+  const_iterator operator--(int) { const_iterator temp(*this); --*this; return temp; }
   bool operator!=(const const_iterator& other) const {
-    return ref != other.ref || !equals(other.state);
+    VGSI_CHECK(detail::check_comparable(*this, other));
+    return !equals(other.state);
   }
   bool operator==(const const_iterator& other) const {
     return !operator!=(other);
   }
-  const_iterator& operator=(const iterator<C,T,S>& other) {
-    ref = other.ref;
+
+  // Random access operators (require `advance()` and `distance()`):
+  const_iterator& operator+=(difference_type n) {
+    VGSI_CHECK(detail::check_valid(*this));
+    advance(n);
+    return *this;
+  }
+  const_iterator& operator-=(difference_type n) { return *this += -n; }
+  const_iterator operator+(difference_type n) const { const_iterator temp(*this); return temp += n; }
+  const_iterator operator-(difference_type n) const { const_iterator temp(*this); return temp -= n; }
+  friend const_iterator operator+(difference_type n, const const_iterator& it) { return it + n; }
+  difference_type operator-(const const_iterator& other) const {
+    VGSI_CHECK(detail::check_comparable(*this, other));
+    return distance(other.state);
+  }
+  const T operator[](difference_type n) const { return *(*this + n); }
+  bool operator< (const const_iterator& other) const { return *this - other < 0; }
+  bool operator> (const const_iterator& other) const { return *this - other > 0; }
+  bool operator<=(const const_iterator& other) const { return *this - other <= 0; }
+  bool operator>=(const const_iterator& other) const { return *this - other >= 0; }
+
+  template <typename U>
+  const_iterator& operator=(const iterator<C,U,S>& other) {
+    this->set_ref(other.ref);
     state = other.state;
+    VGSI_CHECK(generation = other.generation);
     return *this;
   }
 
-  friend struct iterator_tpl::iterator<C,T,S>;
+  template <class, typename, class>
+  friend struct iterator_tpl::iterator;
 
   // Comparisons between const and normal iterators:
-  bool operator!=(const iterator<C,T,S>& other) const {
-    return ref != other.ref || !equals(other.state);
+  template <typename U>
+  bool operator!=(const iterator<C,U,S>& other) const {
+    VGSI_CHECK(detail::check_comparable(*this, other));
+    return !equals(other.state);
   }
-  bool operator==(const iterator<C,T,S>& other) const {
+  template <typename U>
+  bool operator==(const iterator<C,U,S>& other) const {
     return !operator!=(other);
   }
 };
 
 // This specialization is used for iterators to reference types:
 template <class C, typename T, class S>
-struct const_iterator<C,T&,S> {
-  // Keeps a reference to the container:
-  const C* ref;
+struct const_iterator<C,T&,S>
+  : detail::ref_storage<const C, detail::stores_ref<S>::value> {
+  // STL iterator traits:
+  typedef typename detail::state_category<S>::type iterator_category;
+  typedef std::ptrdiff_t difference_type;
+  typedef T value_type;
+  typedef const T& reference;
+  typedef const T* pointer;
+  // Returned by the postfix `operator++`, see `postfix_proxy`:
+  typedef typename detail::if_<detail::is_input<iterator_category>::value,
+    postfix_proxy<value_type>, const_iterator>::type postfix_type;
+#if __cplusplus >= 202002L
+  typedef typename detail::if_<detail::state_category<S>::contiguous,
+    std::contiguous_iterator_tag, iterator_category>::type iterator_concept;
+#endif
+
+  // Keeps a reference to the container, unless the state doesn't use it:
+  typedef detail::ref_storage<const C, detail::stores_ref<S>::value> ref_storage;
+  using ref_storage::ref;
 
   // User defined struct to describe the iterator state:
   // This struct should provide the functions listed below,
   // however, note that some of them are optional
   S state;
 
+#if VGSI_CHECKED_ITERATORS
+  // The container generation when the iterator was created,
+  // see the optional `generation()` function of the state:
+  std::size_t generation;
+#endif
+
   // Set iterator to next() state:
-  void next()  { state.next(ref);  }
+  void next()  { VGSI_PROBE(next); state.next(ref); }
   // Initialize iterator to first state:
   void begin() { state.begin(ref); }
   // Initialize iterator to end state:
   void end()   { state.end(ref);   }
   // Returns current `value`
-  const T& get() { return state.get(ref); }
+  // (iterators are const like pointers are, i.e. their constness
+  // doesn't propagate to the container or to the state)
+  const T& get() const {
+    VGSI_PROBE(get);
+    return const_cast<S&>(state).get(ref);
+  }
   // Return true if `state != s`:
-  bool equals(const S& s) const { return state.equals(s); }
+  bool equals(const S& s) const { VGSI_PROBE(equals); return state.equals(s); }
 
   // Optional function for reverse iteration:
-  void prev() { state.prev(ref); }
+  void prev() { VGSI_PROBE(prev); state.prev(ref); }
+
+  // Optional function for sentinels:
+  bool at_end() const { VGSI_PROBE(at_end); return state.at_end(ref); }
+
+  // Optional function for sized ranges, the number of elements
+  // from the current one to the end:
+  difference_type remaining() const { return state.remaining(ref); }
+
+  // Optional functions for random access:
+  void advance(difference_type n) { VGSI_PROBE(advance); state.advance(ref, n); }
+  difference_type distance(const S& s) const {
+    VGSI_PROBE(distance);
+    return state.distance(ref, s);
+  }
+
+  // Optional function for contiguous storage, returns
+  // the address of the current element (even for `end()`):
+  const T* data() const { return const_cast<S&>(state).data(ref); }
+
+  // Optional function for block iteration, returns the contiguous
+  // elements starting at the current one and moves past them:
+  block<const T> next_block() { return state.next_block(ref); }
+
+  // Uses `data()` when available since it is also valid for `end()`:
+  const T* address() const {
+    return detail::address<const T*>(const_cast<S&>(state), ref,
+      detail::bool_<detail::has_data<S>::value>());
+  }
 
  public:
   static const_iterator begin(const C* ref) {
     const_iterator it(ref);
-    it.begin();
+    it.state.begin(ref);
+    VGSI_CHECK(detail::init_checks(it));
     return it;
   }
   static const_iterator end(const C* ref) {
     const_iterator it(ref);
-    it.end();
+    it.state.end(ref);
+    VGSI_CHECK(detail::init_checks(it));
     return it;
   }
 
  protected:
-  const_iterator(const C* ref) : ref(ref) {}
+  const_iterator(const C* ref) : ref_storage(ref) {}
 
  public:
   // Note: Instances build with this constructor should
@@ -395,26 +1461,64 @@ struct const_iterator<C,T&,S> {
   const_iterator() {}
 
   // To make possible copy-construct non-const iterators:
-  const_iterator(const iterator<C,T&,S>& other) : ref(other.ref) {
+  const_iterator(const iterator<C,T&,S>& other) : ref_storage(other.ref) {
     state = other.state;
+    VGSI_CHECK(generation = other.generation);
   }
 
  public:
-  const T& operator*()  { return  get(); }
-  const T* operator->() { return &get(); }
-  const_iterator& operator++() { next(); return *this; }
-  const_iterator operator++(int) { const_iterator temp(*this); next(); return temp; }
-  const_iterator& operator--() { prev(); return *this; }
-  const_iterator operator--(int) { const_iterator temp(*this); prev(); return temp; }
+  const T& operator*() const {
+    VGSI_CHECK(detail::check_dereferenceable(*this));
+    return get();
+  }
+  const T* operator->() const {
+    VGSI_CHECK(detail::check_valid(*this));
+    return address();
+  }
+  const_iterator& operator++() {
+    VGSI_CHECK(detail::check_dereferenceable(*this));
+    next();
+    return *this;
+  }
+  postfix_type operator++(int) { postfix_type temp(*this); ++*this; return temp; }
+  const_iterator& operator--() {
+    VGSI_CHECK(detail::check_valid(*this));
+    prev();
+    return *this;
+  }
+  const_iterator operator--(int) { const_iterator temp(*this); --*this; return temp; }
   bool operator!=(const const_iterator& other) const {
-    return ref != other.ref || !equals(other.state);
+    VGSI_CHECK(detail::check_comparable(*this, other));
+    return !equals(other.state);
   }
   bool operator==(const const_iterator& other) const {
     return !operator!=(other);
   }
+
+  // Random access operators (require `advance()` and `distance()`):
+  const_iterator& operator+=(difference_type n) {
+    VGSI_CHECK(detail::check_valid(*this));
+    advance(n);
+    return *this;
+  }
+  const_iterator& operator-=(difference_type n) { return *this += -n; }
+  const_iterator operator+(difference_type n) const { const_iterator temp(*this); return temp += n; }
+  const_iterator operator-(difference_type n) const { const_iterator temp(*this); return temp -= n; }
+  friend const_iterator operator+(difference_type n, const const_iterator& it) { return it + n; }
+  difference_type operator-(const const_iterator& other) const {
+    VGSI_CHECK(detail::check_comparable(*this, other));
+    return distance(other.state);
+  }
+  const T& operator[](difference_type n) const { return *(*this + n); }
+  bool operator< (const const_iterator& other) const { return *this - other < 0; }
+  bool operator> (const const_iterator& other) const { return *this - other > 0; }
+  bool operator<=(const const_iterator& other) const { return *this - other <= 0; }
+  bool operator>=(const const_iterator& other) const { return *this - other >= 0; }
+
   const_iterator& operator=(const iterator<C,T&,S>& other) {
-    ref = other.ref;
+    this->set_ref(other.ref);
     state = other.state;
+    VGSI_CHECK(generation = other.generation);
     return *this;
   }
 
@@ -422,13 +1526,1787 @@ struct const_iterator<C,T&,S> {
 
   // Comparisons between const and normal iterators:
   bool operator!=(const iterator<C,T&,S>& other) const {
-    return ref != other.ref || !equals(other.state);
+    VGSI_CHECK(detail::check_comparable(*this, other));
+    return !equals(other.state);
   }
   bool operator==(const iterator<C,T&,S>& other) const {
     return !operator!=(other);
   }
 };
 
+/* * * * * ALGORITHMS: * * * * */
+
+// True if `It` is an iterator over contiguous storage:
+template <class It>
+struct is_contiguous : detail::bool_<false> {};
+template <class T>
+struct is_contiguous<T*> : detail::bool_<true> {};
+template <class C, class T, class S>
+struct is_contiguous<iterator<C,T&,S> >
+  : detail::bool_<detail::state_category<S>::contiguous> {};
+template <class C, class T, class S>
+struct is_contiguous<const_iterator<C,T&,S> >
+  : detail::bool_<detail::state_category<S>::contiguous> {};
+
+namespace detail {
+
+// Converts contiguous iterators to raw pointers and back, so the
+// STL algorithms can use their memmove/memcmp implementations:
+template <class It, bool = is_contiguous<It>::value>
+struct unwrapper {
+  typedef It type;
+  static It unwrap(const It& it) { return it; }
+  static It rewrap(const It&, const It& it) { return it; }
+};
+
+template <class It>
+struct unwrapper<It, true> {
+  typedef typename std::iterator_traits<It>::pointer type;
+  static type unwrap(const It& it) { return it.data(); }
+  static It rewrap(const It& it, type p) { return it + (p - it.data()); }
+};
+
+template <class T>
+struct unwrapper<T*, true> {
+  typedef T* type;
+  static T* unwrap(T* it) { return it; }
+  static T* rewrap(T*, T* it) { return it; }
+};
+
+template <class P> struct pointee;
+template <class T> struct pointee<T*> { typedef T type; };
+
+// The iterator used for iterating over a container of type `C`:
+template <class C>
+struct container_iterator { typedef typename C::iterator type; };
+template <class C>
+struct container_iterator<const C> { typedef typename C::const_iterator type; };
+
+// True if `It` provides `next_block()`:
+template <class It>
+struct has_blocks : bool_<false> {};
+template <class C, class T, class S>
+struct has_blocks<iterator<C,T&,S> > : has_next_block<S> {};
+template <class C, class T, class S>
+struct has_blocks<const_iterator<C,T&,S> > : has_next_block<S> {};
+
+template <class It, class F>
+inline F for_each_block(It first, It last, F f, bool_<true>) {
+  while (first != last) {
+    block<typename pointee<typename It::pointer>::type> b = first.next_block();
+    f(b.data, b.size);
+  }
+  return f;
+}
+
+template <class It, class F>
+inline F for_each_block(It first, It last, F f, bool_<false>) {
+  for (; first != last; ++first) f(&*first, 1);
+  return f;
+}
+
+template <class F>
+struct transform_in_place {
+  F f;
+  template <typename T>
+  void operator()(T* data, std::size_t size) {
+    for (std::size_t i = 0; i < size; ++i) data[i] = f(data[i]);
+  }
+};
+
+template <class Out, class F>
+struct transform_to {
+  Out out;
+  F f;
+  template <typename T>
+  void operator()(T* data, std::size_t size) {
+    for (std::size_t i = 0; i < size; ++i, ++out) *out = f(data[i]);
+  }
+};
+
+}  // namespace detail
+
+// Replacements for `std::copy()`, `std::fill()` and `std::equal()` that work
+// on raw pointers when the iterators are contiguous. (They have different
+// names so unqualified calls to the STL versions aren't ambiguous.)
+template <class InputIt, class OutputIt>
+inline OutputIt copy_fast(InputIt first, InputIt last, OutputIt out) {
+  typedef detail::unwrapper<InputIt> in;
+  typedef detail::unwrapper<OutputIt> res;
+  return res::rewrap(out,
+    std::copy(in::unwrap(first), in::unwrap(last), res::unwrap(out)));
+}
+
+template <class ForwardIt, class V>
+inline void fill_fast(ForwardIt first, ForwardIt last, const V& value) {
+  typedef detail::unwrapper<ForwardIt> it;
+  std::fill(it::unwrap(first), it::unwrap(last), value);
+}
+
+template <class InputIt1, class InputIt2>
+inline bool equal_fast(InputIt1 first1, InputIt1 last1, InputIt2 first2) {
+  typedef detail::unwrapper<InputIt1> it1;
+  typedef detail::unwrapper<InputIt2> it2;
+  return std::equal(it1::unwrap(first1), it1::unwrap(last1), it2::unwrap(first2));
+}
+
+
+// Calls `f(T* data, std::size_t size)` for each contiguous block of
+// elements of `c`, so `f` can use SIMD instructions on each block.
+// It uses the optional `next_block()` function of the state when
+// available and passes one element at a time otherwise:
+template <class C, class F>
+inline F for_each_block(C& c, F f) {
+  typedef typename detail::container_iterator<C>::type It;
+  It first = c.begin(), last = c.end();
+  return detail::for_each_block(first, last, f,
+    detail::bool_<detail::has_blocks<It>::value>());
+}
+
+// Replaces each element `x` of `c` with `f(x)`, one block at a time:
+template <class C, class F>
+inline F transform_block(C& c, F f) {
+  detail::transform_in_place<F> op = { f };
+  return for_each_block(c, op).f;
+}
+
+// Writes `f(x)` to `out` for each element `x` of `c`, one block at a time:
+template <class C, class OutputIt, class F>
+inline OutputIt transform_block(C& c, OutputIt out, F f) {
+  typedef detail::unwrapper<OutputIt> res;
+  detail::transform_to<typename res::type, F> op = { res::unwrap(out), f };
+  return res::rewrap(out, for_each_block(c, op).out);
+}
+
+/* * * * * INTERNAL ITERATION: * * * * */
+
+// States may provide `template <class F> bool for_each(C* ref, F& f)`,
+// called on a default constructed state, pushing each element `x` to
+// `f(x)` in order and returning false as soon as `f` does, e.g.:
+//
+//   template <class F>
+//   bool for_each(const tree* ref, F& f) { return visit(ref->root, f); }
+//
+// So recursive structures don't need an explicit stack in the state.
+// The algorithms below use it when available and the iterators otherwise.
+namespace detail {
+
+// The state and the container of the iterator `It`:
+template <class It>
+struct state_of { struct none {}; typedef none type; };
+template <class C, class T, class S>
+struct state_of<iterator<C,T,S> > { typedef S type; typedef C container; };
+template <class C, class T, class S>
+struct state_of<const_iterator<C,T,S> > { typedef S type; typedef const C container; };
+
+template <class F>
+struct visit_all {
+  F f;
+  template <typename X>
+  bool operator()(X& x) { f(x); return true; }
+  template <typename X>
+  bool operator()(const X& x) { f(x); return true; }
+};
+
+template <class Pred, typename P>
+struct visit_until {
+  Pred pred;
+  // The first element for which `pred` returned true, if any:
+  P found;
+  bool any;
+  template <typename X>
+  bool operator()(X& x) { return test(x, &x); }
+  template <typename X>
+  bool operator()(const X& x) { return test(x, &x); }
+ private:
+  template <typename X, typename Q>
+  bool test(X& x, Q address) {
+    if (!pred(x)) return true;
+    found = address;
+    any = true;
+    return false;
+  }
+};
+
+// Pushes the elements of `c` to `f(x)` until it returns false:
+template <class C, class F>
+inline void visit(C& c, F& f, bool_<true>) {
+  typedef typename state_of<typename container_iterator<C>::type>::type S;
+  S().for_each(&c, f);
+}
+
+template <class C, class F>
+inline void visit(C& c, F& f, bool_<false>) {
+  typedef typename container_iterator<C>::type It;
+  It first = c.begin(), last = c.end();
+  for (; first != last; ++first) {
+    if (!f(*first)) return;
+  }
+}
+
+template <class C, class F>
+inline void visit(C& c, F& f) {
+  typedef typename state_of<typename container_iterator<C>::type>::type S;
+  visit(c, f, bool_<has_for_each<S>::value>());
+}
+
+}  // namespace detail
+
+// Calls `f(x)` for each element `x` of `c`:
+template <class C, class F>
+inline F for_each(C& c, F f) {
+  detail::visit_all<F> v = { f };
+  detail::visit(c, v);
+  return v.f;
+}
+
+// Returns the address of the first element `x` of `c` for which `pred(x)`
+// is true, or null if there is none (requires iterators to references):
+template <class C, class Pred>
+inline typename std::iterator_traits<
+  typename detail::container_iterator<C>::type>::pointer
+find_if(C& c, Pred pred) {
+  typedef typename std::iterator_traits<
+    typename detail::container_iterator<C>::type>::pointer P;
+  detail::visit_until<Pred, P> v = { pred, 0, false };
+  detail::visit(c, v);
+  return v.found;
+}
+
+// True if `pred(x)` is true for any element `x` of `c`,
+// stopping at the first one:
+template <class C, class Pred>
+inline bool any_of(C& c, Pred pred) {
+  detail::visit_until<Pred, const void*> v = { pred, 0, false };
+  detail::visit(c, v);
+  return v.any;
+}
+
+/* * * * * SIZED RANGES: * * * * */
+
+// States may provide `std::ptrdiff_t remaining(const C* ref) const`, returning
+// the number of elements from the current one to the end, so the size of a
+// range is known without visiting it even when it isn't random access.
+
+// Declares `size()` and `empty()` for containers whose state provides `remaining()`:
+#define VGSI_SETUP_SIZE(C, S)                                  \
+  std::size_t size() const {                                  \
+    S s;                                                      \
+    s.begin(this);                                            \
+    return s.remaining(this);                                 \
+  }                                                           \
+  bool empty() const { return size() == 0; }
+
+#ifndef SETUP_SIZE
+#define SETUP_SIZE(C, S) VGSI_SETUP_SIZE(C, S)
+#endif
+
+namespace detail {
+
+template <class It>
+inline typename std::iterator_traits<It>::difference_type
+distance(It first, It last, bool_<true>) {
+  return first.remaining() - last.remaining();
+}
+
+template <class It>
+inline typename std::iterator_traits<It>::difference_type
+distance(It first, It last, bool_<false>) {
+  return std::distance(first, last);
+}
+
+template <class It>
+struct is_sized : has_remaining<typename state_of<It>::type> {};
+
+template <class Tag>
+struct is_random_access_tag : bool_<false> {};
+template <>
+struct is_random_access_tag<std::random_access_iterator_tag> : bool_<true> {};
+
+// True if the distance between two `It`s is computed without visiting the range:
+template <class It>
+struct has_fast_distance : bool_<is_sized<It>::value || is_random_access_tag<
+  typename std::iterator_traits<It>::iterator_category>::value> {};
+
+}  // namespace detail
+
+// Same as `std::distance()`, but without visiting the range when the
+// state provides `remaining()`. (These have different names than the STL
+// functions so unqualified calls to those aren't ambiguous.)
+template <class It>
+inline typename std::iterator_traits<It>::difference_type
+sized_distance(It first, It last) {
+  return detail::distance(first, last, detail::bool_<detail::is_sized<It>::value>());
+}
+
+// The number of elements of `c`:
+template <class C>
+inline std::size_t range_size(C& c) {
+  typedef typename detail::container_iterator<C>::type It;
+  It first = c.begin(), last = c.end();
+  return iterator_tpl::sized_distance(first, last);
+}
+
+// Appends the elements of `c` to `out`, e.g. an `std::vector`, reserving
+// the memory once when the size of `c` is known without visiting it:
+template <class Out, class C>
+inline Out& append(Out& out, C& c) {
+  typedef typename detail::container_iterator<C>::type It;
+  It first = c.begin(), last = c.end();
+  if (detail::has_fast_distance<It>::value) {
+    out.reserve(out.size() + iterator_tpl::sized_distance(first, last));
+  }
+  for (; first != last; ++first) out.push_back(*first);
+  return out;
+}
+
+/* * * * * STRIDED VIEWS: * * * * */
+
+// The stride of a `strided_view` chosen at runtime:
+enum { dynamic_stride = 0 };
+
+// The elements `first[0]`, `first[stride]`, `first[2 * stride]`, ... of an
+// array, e.g. a column of a row-major matrix (see `column()`) or one channel
+// of interleaved samples. When `Stride` is given at compile time the
+// optimizer sees a constant step, otherwise it is read from `step`:
+template <typename T, std::ptrdiff_t Stride = dynamic_stride>
+struct strided_view {
+  T* first;
+  std::size_t count;
+  std::ptrdiff_t step;
+
+  std::ptrdiff_t stride() const { return Stride != dynamic_stride ? Stride : step; }
+  std::size_t size() const { return count; }
+  bool empty() const { return count == 0; }
+  T& operator[](std::size_t i) const { return first[std::ptrdiff_t(i) * stride()]; }
+
+  struct it_state {
+    std::ptrdiff_t pos;
+    inline void next(const strided_view* ref) { ++pos; }
+    inline void prev(const strided_view* ref) { --pos; }
+    inline void begin(const strided_view* ref) { pos = 0; }
+    inline void end(const strided_view* ref) { pos = ref->count; }
+    inline T& get(const strided_view* ref) { return (*ref)[pos]; }
+    inline bool equals(const it_state& s) const { return pos == s.pos; }
+    inline void advance(const strided_view* ref, std::ptrdiff_t n) { pos += n; }
+    inline std::ptrdiff_t distance(const strided_view* ref, const it_state& s) const {
+      return pos - s.pos;
+    }
+  };
+  VGSI_SETUP_ITERATORS(strided_view, T&, it_state)
+  VGSI_SETUP_REVERSE_ITERATORS(strided_view, T&, it_state)
+};
+
+template <typename T>
+inline strided_view<T> strided(T* first, std::size_t count, std::ptrdiff_t stride) {
+  strided_view<T> v = { first, count, stride };
+  return v;
+}
+
+// The column `j` of a row-major matrix with `rows` rows of `cols` elements:
+template <typename T>
+inline strided_view<T> column(T* matrix, std::size_t rows, std::size_t cols,
+                              std::size_t j) {
+  return strided(matrix + j, rows, std::ptrdiff_t(cols));
+}
+
+namespace detail {
+
+// Copies `n` elements, `stride` apart, from `first` to `out`:
+template <typename T, typename V>
+inline void gather(const T* first, std::ptrdiff_t stride, std::size_t n, V* out) {
+  for (std::size_t i = 0; i < n; ++i) out[i] = first[std::ptrdiff_t(i) * stride];
+}
+
+#if defined(__AVX2__)
+// Loads 8 elements per instruction (if the offsets fit in 32 bits):
+template <typename V, typename Vec, class Load, class Store>
+inline void gather8(const V* first, std::ptrdiff_t stride, std::size_t n, V* out,
+                    Load load, Store store) {
+  std::size_t i = 0;
+  if (stride > -(1 << 27) && stride < (1 << 27)) {
+    __m256i offsets = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+                                         _mm256_set1_epi32(int(stride)));
+    for (; i + 8 <= n; i += 8, first += 8 * stride) store(out + i, load(first, offsets));
+  }
+  gather(first, stride, n - i, out + i);
+}
+
+struct gather_ps {
+  __m256 operator()(const float* p, __m256i offsets) const {
+    return _mm256_i32gather_ps(p, offsets, 4);
+  }
+};
+struct store_ps {
+  void operator()(float* p, __m256 v) const { _mm256_storeu_ps(p, v); }
+};
+struct gather_epi32 {
+  __m256i operator()(const int* p, __m256i offsets) const {
+    return _mm256_i32gather_epi32(p, offsets, 4);
+  }
+};
+struct store_epi32 {
+  void operator()(int* p, __m256i v) const {
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v);
+  }
+};
+
+inline void gather(const float* first, std::ptrdiff_t stride, std::size_t n, float* out) {
+  gather8<float, __m256>(first, stride, n, out, gather_ps(), store_ps());
+}
+inline void gather(const int* first, std::ptrdiff_t stride, std::size_t n, int* out) {
+  gather8<int, __m256i>(first, stride, n, out, gather_epi32(), store_epi32());
+}
+#endif
+
+}  // namespace detail
+
+// Calls `f(const V* data, std::size_t size)` with copies of up to 64
+// consecutive elements of `v` at a time, so `f` can use SIMD instructions
+// on them. The copies use gather instructions when available (AVX2):
+template <typename T, std::ptrdiff_t Stride, class F>
+inline F gather_blocks(const strided_view<T, Stride>& v, F f) {
+  typedef typename detail::remove_const<T>::type V;
+  V buffer[64];
+  for (std::size_t i = 0; i < v.count; i += 64) {
+    std::size_t n = std::min<std::size_t>(64, v.count - i);
+    detail::gather(&v[i], v.stride(), n, buffer);
+    f(static_cast<const V*>(buffer), n);
+  }
+  return f;
+}
+
+/* * * * * TILED TRAVERSAL: * * * * */
+
+#if __cplusplus >= 201103L
+namespace detail {
+
+VGSI_DEFINE_HAS_MEMBER(depth);
+
+template <class C>
+inline std::ptrdiff_t depth(const C* ref, bool_<true>) { return ref->depth(); }
+template <class C>
+inline std::ptrdiff_t depth(const C*, bool_<false>) { return 1; }
+
+// Extracts the even bits (for 2 dimensions) or every third bit (for 3):
+inline unsigned long long compact_bits(unsigned long long v, bool_<false>) {
+  v &= 0x5555555555555555ULL;
+  v = (v | (v >> 1)) & 0x3333333333333333ULL;
+  v = (v | (v >> 2)) & 0x0F0F0F0F0F0F0F0FULL;
+  v = (v | (v >> 4)) & 0x00FF00FF00FF00FFULL;
+  v = (v | (v >> 8)) & 0x0000FFFF0000FFFFULL;
+  return (v | (v >> 16)) & 0x00000000FFFFFFFFULL;
+}
+inline unsigned long long compact_bits(unsigned long long v, bool_<true>) {
+  v &= 0x1249249249249249ULL;
+  v = (v | (v >> 2)) & 0x10C30C30C30C30C3ULL;
+  v = (v | (v >> 4)) & 0x100F00F00F00F00FULL;
+  v = (v | (v >> 8)) & 0x001F0000FF0000FFULL;
+  v = (v | (v >> 16)) & 0x001F00000000FFFFULL;
+  return (v | (v >> 32)) & 0x00000000001FFFFFULL;
+}
+
+// The position of the highest bit set in `mask`, which must not be 0:
+inline int highest_bit(unsigned long long mask) {
+#if defined(__GNUC__)
+  return 63 - __builtin_clzll(mask);
+#else
+  int n = 0;
+  while (mask >>= 1) ++n;
+  return n;
+#endif
+}
+
+// The smallest Morton code not less than `z` whose coordinates are within
+// a grid of `n[0]` x `n[1]` (x `n[2]`) tiles, or false if there is none.
+// When a coordinate `c` of `z` is too large, all the codes from `z` until
+// the bits above the highest bit where `c` differs from the last coordinate
+// change are too large as well, so they are skipped at once:
+template <bool ThreeD>
+inline bool next_morton_code(unsigned long long z, const std::ptrdiff_t* n,
+                             unsigned long long& result) {
+  const int dims = ThreeD ? 3 : 2;
+  // (`compact_bits()` decodes 21 bits per coordinate in 3D)
+  const int bits = ThreeD ? 63 : 64;
+  for (;;) {
+    if (ThreeD && (z >> 62) > 1) return false;
+    int p = -1;
+    for (int a = 0; a < dims; ++a) {
+      unsigned long long c = compact_bits(z >> a, bool_<ThreeD>());
+      unsigned long long last = n[a] - 1;
+      if (c > last) p = std::max(p, dims * highest_bit(c ^ last) + a);
+    }
+    if (p < 0) {
+      result = z;
+      return true;
+    }
+    if (p + 1 >= bits) return false;
+    z = ((z >> (p + 1)) + 1) << (p + 1);
+    if (z == 0) return false;
+  }
+}
+
+}  // namespace detail
+
+// The order in which `tiled_state` visits the tiles:
+// - `row_major_tiles`: left to right, then top to bottom, then front to back.
+// - `morton_tiles`: in Morton (Z) order, so nearby tiles are visited close in
+//   time in every direction. With 1x1x1 tiles it visits the elements in Morton order.
+//   Grids may have up to 2^32 tiles per axis in 2D and 2^21 in 3D.
+enum tile_order { row_major_tiles, morton_tiles };
+
+// A state visiting the elements of a 2D or 3D grid one tile of
+// `TileX` x `TileY` x `TileZ` elements at a time, row by row inside
+// each tile, so neighbourhood passes reuse the cached rows of the tile.
+//
+// `C` must provide `width()`, `height()`, optionally `depth()`, and
+// `data()`, returning its elements in row-major order (`x` varying fastest).
+// Each step costs an increment and a comparison, the rest of the index
+// arithmetic is done once per row and once per tile, and `next_block()`
+// returns the rest of the current row of the tile.
+template <class C, typename T, int TileX, int TileY, int TileZ = 1,
+          tile_order Order = row_major_tiles>
+struct tiled_state {
+  // The current element of `data()`, or its size at the end:
+  std::ptrdiff_t offset;
+  // The position inside the current tile and the size of the tile:
+  std::ptrdiff_t i, j, k;
+  std::ptrdiff_t w, h, d;
+  // The index of the current tile, in `Order`:
+  unsigned long long tile;
+
+  inline void next(const C* ref) {
+    ++offset;
+    if (++i < w) return;
+    next_row(ref);
+  }
+  inline void begin(const C* ref) {
+    tile = 0;
+    if (width(ref) * height(ref) * depth(ref) == 0) return end(ref);
+    start_tile(ref, 0, 0, 0);
+  }
+  inline void end(const C* ref) {
+    offset = width(ref) * height(ref) * depth(ref);
+    i = j = k = w = h = d = 0;
+  }
+  inline T& get(C* ref) { return ref->data()[offset]; }
+  inline const T& get(const C* ref) { return ref->data()[offset]; }
+  inline bool equals(const tiled_state& s) const { return offset == s.offset; }
+
+  inline block<T> next_block(C* ref) {
+    block<T> b = make_block(ref->data() + offset, std::size_t(w - i));
+    skip_row(ref);
+    return b;
+  }
+  inline block<const T> next_block(const C* ref) {
+    block<const T> b = make_block(ref->data() + offset, std::size_t(w - i));
+    skip_row(ref);
+    return b;
+  }
+
+ private:
+  static std::ptrdiff_t width(const C* ref) { return ref->width(); }
+  static std::ptrdiff_t height(const C* ref) { return ref->height(); }
+  static std::ptrdiff_t depth(const C* ref) {
+    return detail::depth(ref, detail::bool_<detail::has_depth<C>::value>());
+  }
+  static std::ptrdiff_t tiles(std::ptrdiff_t n, int size) { return (n + size - 1) / size; }
+
+  inline void skip_row(const C* ref) {
+    offset += w - i - 1;
+    i = w - 1;
+    next(ref);
+  }
+
+  inline void next_row(const C* ref) {
+    i = 0;
+    offset += width(ref) - w;
+    if (++j < h) return;
+    j = 0;
+    offset += width(ref) * (height(ref) - h);
+    if (++k < d) return;
+    next_tile(ref);
+  }
+
+  inline void start_tile(const C* ref, std::ptrdiff_t tx, std::ptrdiff_t ty,
+                         std::ptrdiff_t tz) {
+    std::ptrdiff_t x = tx * TileX, y = ty * TileY, z = tz * TileZ;
+    w = std::min<std::ptrdiff_t>(TileX, width(ref) - x);
+    h = std::min<std::ptrdiff_t>(TileY, height(ref) - y);
+    d = std::min<std::ptrdiff_t>(TileZ, depth(ref) - z);
+    i = j = k = 0;
+    offset = (z * height(ref) + y) * width(ref) + x;
+  }
+
+  void next_tile(const C* ref) {
+    std::ptrdiff_t nx = tiles(width(ref), TileX);
+    std::ptrdiff_t ny = tiles(height(ref), TileY);
+    std::ptrdiff_t nz = tiles(depth(ref), TileZ);
+    if (Order == row_major_tiles) {
+      if (std::ptrdiff_t(++tile) == nx * ny * nz) return end(ref);
+      return start_tile(ref, tile % nx, tile / nx % ny, tile / (nx * ny));
+    }
+    // The Morton codes of the grid are not contiguous, so jump
+    // over the codes outside it:
+    const std::ptrdiff_t n[] = { nx, ny, nz };
+    unsigned long long code;
+    if (nz > 1) {
+      detail::bool_<true> three_d;
+      if (detail::next_morton_code<true>(tile + 1, n, code)) {
+        tile = code;
+        return start_tile(ref, detail::compact_bits(code, three_d),
+                          detail::compact_bits(code >> 1, three_d),
+                          detail::compact_bits(code >> 2, three_d));
+      }
+    } else {
+      detail::bool_<false> two_d;
+      if (detail::next_morton_code<false>(tile + 1, n, code)) {
+        tile = code;
+        return start_tile(ref, detail::compact_bits(code, two_d),
+                          detail::compact_bits(code >> 1, two_d), 0);
+      }
+    }
+    end(ref);
+  }
+};
+#endif
+
+/* * * * * TREE TRAVERSAL: * * * * */
+
+// States for the usual traversals of trees, keeping their stack (or queue)
+// in the state, in an inline buffer of `N` entries that is moved to the heap
+// only for deeper (or wider) trees, so `begin()` and copying the iterators
+// don't allocate memory. Nodes with several parents, as in DAGs and graphs,
+// need the graph states below instead.
+//
+// `Traits` describes the tree of the container `C`:
+//
+//   struct my_traits {
+//     typedef node* node_type;  // Compared with 0 for missing children
+//     static node* root(const C* ref);
+//     static std::size_t child_count(node* n);  // 2 for binary trees
+//     static node* child(node* n, std::size_t i);
+//     static T& value(node* n);
+//   };
+
+namespace detail {
+
+// An array of up to `N` elements stored inline, or more on the heap:
+template <typename V, std::size_t N>
+class small_buffer {
+ protected:
+  V inline_items[N];
+  V* items;
+  std::size_t capacity;
+
+  small_buffer() : items(inline_items), capacity(N) {}
+  ~small_buffer() { if (items != inline_items) delete[] items; }
+
+  // Grows the buffer, copying the `count` elements starting at `first`,
+  // as if the buffer was circular, to its beginning:
+  void grow(std::size_t first, std::size_t count) {
+    V* bigger = new V[2 * capacity];
+    for (std::size_t i = 0; i < count; ++i) bigger[i] = items[(first + i) % capacity];
+    if (items != inline_items) delete[] items;
+    items = bigger;
+    capacity *= 2;
+  }
+  // Copies the `count` elements of `other` starting at `first`:
+  void assign(const small_buffer& other, std::size_t first, std::size_t count) {
+    while (capacity < count) grow(0, 0);
+    for (std::size_t i = 0; i < count; ++i) {
+      items[i] = other.items[(first + i) % other.capacity];
+    }
+  }
+#if __cplusplus >= 201103L
+  // Takes the heap buffer of `other`, if any:
+  bool steal(small_buffer& other) {
+    if (other.items == other.inline_items) return false;
+    if (items != inline_items) delete[] items;
+    items = other.items;
+    capacity = other.capacity;
+    other.items = other.inline_items;
+    other.capacity = N;
+    return true;
+  }
+#endif
+};
+
+template <typename V, std::size_t N>
+class small_stack : small_buffer<V, N> {
+  typedef small_buffer<V, N> buffer;
+  std::size_t count;
+
+ public:
+  small_stack() : count(0) {}
+  small_stack(const small_stack& other) : count(other.count) {
+    buffer::assign(other, 0, count);
+  }
+  small_stack& operator=(const small_stack& other) {
+    if (this != &other) {
+      buffer::assign(other, 0, other.count);
+      count = other.count;
+    }
+    return *this;
+  }
+#if __cplusplus >= 201103L
+  small_stack(small_stack&& other) : count(other.count) {
+    if (!buffer::steal(other)) buffer::assign(other, 0, count);
+    other.count = 0;
+  }
+  small_stack& operator=(small_stack&& other) {
+    if (this != &other) {
+      if (!buffer::steal(other)) buffer::assign(other, 0, other.count);
+      count = other.count;
+      other.count = 0;
+    }
+    return *this;
+  }
+#endif
+
+  bool empty() const { return count == 0; }
+  // True if the elements were moved to the heap:
+  bool spilled() const { return this->items != this->inline_items; }
+  V& top() const { return this->items[count - 1]; }
+  void pop() { --count; }
+  void clear() { count = 0; }
+  void push(const V& v) {
+    if (count == this->capacity) buffer::grow(0, count);
+    this->items[count++] = v;
+  }
+};
+
+template <typename V, std::size_t N>
+class small_queue : small_buffer<V, N> {
+  typedef small_buffer<V, N> buffer;
+  std::size_t first;
+  std::size_t count;
+
+ public:
+  small_queue() : first(0), count(0) {}
+  small_queue(const small_queue& other) : first(0), count(other.count) {
+    buffer::assign(other, other.first, count);
+  }
+  small_queue& operator=(const small_queue& other) {
+    if (this != &other) {
+      buffer::assign(other, other.first, other.count);
+      first = 0;
+      count = other.count;
+    }
+    return *this;
+  }
+#if __cplusplus >= 201103L
+  small_queue(small_queue&& other) : first(other.first), count(other.count) {
+    if (!buffer::steal(other)) {
+      buffer::assign(other, other.first, count);
+      first = 0;
+    }
+    other.first = other.count = 0;
+  }
+  small_queue& operator=(small_queue&& other) {
+    if (this != &other) {
+      first = other.first;
+      if (!buffer::steal(other)) {
+        buffer::assign(other, other.first, other.count);
+        first = 0;
+      }
+      count = other.count;
+      other.first = other.count = 0;
+    }
+    return *this;
+  }
+#endif
+
+  bool empty() const { return count == 0; }
+  // True if the elements were moved to the heap:
+  bool spilled() const { return this->items != this->inline_items; }
+  V& front() const { return this->items[first]; }
+  void pop() { first = (first + 1) % this->capacity; --count; }
+  void clear() { first = count = 0; }
+  void push(const V& v) {
+    if (count == this->capacity) {
+      buffer::grow(first, count);
+      first = 0;
+    }
+    this->items[(first + count++) % this->capacity] = v;
+  }
+};
+
+// A set of up to `N / 2` nodes stored inline, or more on the heap, with
+// open addressing. Nodes are pointers (or integers), never 0:
+template <typename V, std::size_t N>
+class small_set : small_buffer<V, N> {
+  typedef small_buffer<V, N> buffer;
+  typedef char n_must_be_a_power_of_2[(N & (N - 1)) == 0 ? 1 : -1];
+  std::size_t count;
+
+  static std::size_t hash(V v) {
+    std::size_t h = (std::size_t)v;
+    h ^= h >> 16;
+    h *= 0x45d9f3b;
+    return h ^ (h >> 16);
+  }
+  // The position of `v`, or of the empty entry where it would be:
+  std::size_t find(V v) const {
+    std::size_t i = hash(v) & (this->capacity - 1);
+    while (this->items[i] && this->items[i] != v) i = (i + 1) & (this->capacity - 1);
+    return i;
+  }
+  // Replaces the entries with `capacity` empty ones:
+  void reset(std::size_t capacity) {
+    if (capacity != this->capacity) {
+      if (this->items != this->inline_items) delete[] this->items;
+      this->items = capacity == N ? this->inline_items : new V[capacity];
+      this->capacity = capacity;
+    }
+    std::fill(this->items, this->items + capacity, V());
+    count = 0;
+  }
+  void rehash() {
+    V* old = this->items;
+    std::size_t old_capacity = this->capacity;
+    this->items = new V[2 * old_capacity]();
+    this->capacity *= 2;
+    for (std::size_t i = 0; i < old_capacity; ++i) {
+      if (old[i]) this->items[find(old[i])] = old[i];
+    }
+    if (old != this->inline_items) delete[] old;
+  }
+
+ public:
+  small_set() { reset(N); }
+  small_set(const small_set& other) : count(0) { *this = other; }
+  small_set& operator=(const small_set& other) {
+    if (this != &other) {
+      reset(other.capacity);
+      std::copy(other.items, other.items + other.capacity, this->items);
+      count = other.count;
+    }
+    return *this;
+  }
+#if __cplusplus >= 201103L
+  small_set(small_set&& other) : count(0) { *this = std::move(other); }
+  small_set& operator=(small_set&& other) {
+    if (this != &other) {
+      if (buffer::steal(other)) {
+        count = other.count;
+        other.reset(N);
+      } else {
+        *this = static_cast<const small_set&>(other);
+      }
+    }
+    return *this;
+  }
+#endif
+
+  // True if the nodes were moved to the heap:
+  bool spilled() const { return this->items != this->inline_items; }
+  bool contains(V v) const { return this->items[find(v)] == v; }
+  void clear() { reset(N); }
+  // Returns false if `v` was already in the set:
+  bool insert(V v) {
+    if (2 * (count + 1) > this->capacity) rehash();
+    std::size_t i = find(v);
+    if (this->items[i]) return false;
+    this->items[i] = v;
+    ++count;
+    return true;
+  }
+};
+
+}  // namespace detail
+
+// Visits each node before its children, i.e. a depth-first search:
+template <class C, typename T, class Traits, std::size_t N = 32>
+struct preorder_state {
+  typedef typename Traits::node_type node_type;
+  detail::small_stack<node_type, N> stack;
+
+  inline void next(const C* ref) {
+    node_type n = stack.top();
+    stack.pop();
+    // (the first child on top)
+    for (std::size_t i = Traits::child_count(n); i-- > 0;) {
+      node_type c = Traits::child(n, i);
+      if (c) stack.push(c);
+    }
+  }
+  template <class R>
+  inline void begin(R* ref) {
+    stack.clear();
+    node_type root = Traits::root(ref);
+    if (root) stack.push(root);
+  }
+  inline void end(const C* ref) { stack.clear(); }
+  inline T& get(const C* ref) { return Traits::value(stack.top()); }
+  inline bool equals(const preorder_state& s) const { return current() == s.current(); }
+
+ private:
+  node_type current() const { return stack.empty() ? node_type() : stack.top(); }
+};
+
+// Visits each node after its children:
+template <class C, typename T, class Traits, std::size_t N = 32>
+struct postorder_state {
+  typedef typename Traits::node_type node_type;
+  // A node and the index of its next child to visit:
+  struct frame {
+    node_type node;
+    std::size_t child;
+  };
+  detail::small_stack<frame, N> stack;
+
+  inline void next(const C* ref) {
+    stack.pop();
+    descend();
+  }
+  template <class R>
+  inline void begin(R* ref) {
+    stack.clear();
+    node_type root = Traits::root(ref);
+    if (root) push(root);
+    descend();
+  }
+  inline void end(const C* ref) { stack.clear(); }
+  inline T& get(const C* ref) { return Traits::value(stack.top().node); }
+  inline bool equals(const postorder_state& s) const { return current() == s.current(); }
+
+ private:
+  node_type current() const { return stack.empty() ? node_type() : stack.top().node; }
+  void push(node_type n) {
+    frame f = { n, 0 };
+    stack.push(f);
+  }
+  // Moves to the first node of the top of the stack whose children were all visited:
+  void descend() {
+    while (!stack.empty()) {
+      frame& f = stack.top();
+      std::size_t count = Traits::child_count(f.node);
+      while (f.child < count && !Traits::child(f.node, f.child)) ++f.child;
+      if (f.child == count) return;
+      push(Traits::child(f.node, f.child++));
+    }
+  }
+};
+
+// Visits the left subtree, the node, then the right subtree,
+// for binary trees (where `child(n, 0)` is left and `child(n, 1)` is right):
+template <class C, typename T, class Traits, std::size_t N = 32>
+struct inorder_state {
+  typedef typename Traits::node_type node_type;
+  detail::small_stack<node_type, N> stack;
+
+  inline void next(const C* ref) {
+    node_type n = stack.top();
+    stack.pop();
+    push_left(Traits::child(n, 1));
+  }
+  template <class R>
+  inline void begin(R* ref) {
+    stack.clear();
+    push_left(Traits::root(ref));
+  }
+  inline void end(const C* ref) { stack.clear(); }
+  inline T& get(const C* ref) { return Traits::value(stack.top()); }
+  inline bool equals(const inorder_state& s) const { return current() == s.current(); }
+
+ private:
+  node_type current() const { return stack.empty() ? node_type() : stack.top(); }
+  void push_left(node_type n) {
+    for (; n; n = Traits::child(n, 0)) stack.push(n);
+  }
+};
+
+// Visits the nodes level by level, i.e. a breadth-first search:
+template <class C, typename T, class Traits, std::size_t N = 32>
+struct level_order_state {
+  typedef typename Traits::node_type node_type;
+  detail::small_queue<node_type, N> queue;
+
+  inline void next(const C* ref) {
+    node_type n = queue.front();
+    queue.pop();
+    for (std::size_t i = 0, count = Traits::child_count(n); i < count; ++i) {
+      node_type c = Traits::child(n, i);
+      if (c) queue.push(c);
+    }
+  }
+  template <class R>
+  inline void begin(R* ref) {
+    queue.clear();
+    node_type root = Traits::root(ref);
+    if (root) queue.push(root);
+  }
+  inline void end(const C* ref) { queue.clear(); }
+  inline T& get(const C* ref) { return Traits::value(queue.front()); }
+  inline bool equals(const level_order_state& s) const { return current() == s.current(); }
+
+ private:
+  node_type current() const { return queue.empty() ? node_type() : queue.front(); }
+};
+
+/* * * * * GRAPH TRAVERSAL: * * * * */
+
+// The states above visit a node once for each path from the root, so they
+// never end on cycles. For graphs, where `child()` returns the neighbors of
+// a node, these states also keep the visited nodes in the state, in a set of
+// `2 * N` inline entries (`N` must be a power of 2) moved to the heap only
+// for larger graphs. The nodes must be pointers, or integers other than 0.
+
+// Visits each node reachable from the root once, before the nodes
+// reachable from it, i.e. a depth-first search:
+template <class C, typename T, class Traits, std::size_t N = 32>
+struct graph_dfs_state {
+  typedef typename Traits::node_type node_type;
+  detail::small_stack<node_type, N> stack;
+  detail::small_set<node_type, 2 * N> visited;
+
+  inline void next(const C* ref) {
+    node_type n = stack.top();
+    stack.pop();
+    // (the first neighbor on top)
+    for (std::size_t i = Traits::child_count(n); i-- > 0;) {
+      node_type c = Traits::child(n, i);
+      if (c && !visited.contains(c)) stack.push(c);
+    }
+    skip_visited();
+  }
+  template <class R>
+  inline void begin(R* ref) {
+    stack.clear();
+    visited.clear();
+    node_type root = Traits::root(ref);
+    if (root) stack.push(root);
+    skip_visited();
+  }
+  inline void end(const C* ref) { stack.clear(); }
+  inline T& get(const C* ref) { return Traits::value(stack.top()); }
+  inline bool equals(const graph_dfs_state& s) const { return current() == s.current(); }
+
+ private:
+  node_type current() const { return stack.empty() ? node_type() : stack.top(); }
+  // A node may be pushed again by other neighbors before it is visited:
+  void skip_visited() {
+    while (!stack.empty() && !visited.insert(stack.top())) stack.pop();
+  }
+};
+
+// Visits each node reachable from the root once, nearest
+// nodes first, i.e. a breadth-first search:
+template <class C, typename T, class Traits, std::size_t N = 32>
+struct graph_bfs_state {
+  typedef typename Traits::node_type node_type;
+  detail::small_queue<node_type, N> queue;
+  detail::small_set<node_type, 2 * N> visited;
+
+  inline void next(const C* ref) {
+    node_type n = queue.front();
+    queue.pop();
+    for (std::size_t i = 0, count = Traits::child_count(n); i < count; ++i) {
+      node_type c = Traits::child(n, i);
+      if (c && visited.insert(c)) queue.push(c);
+    }
+  }
+  template <class R>
+  inline void begin(R* ref) {
+    queue.clear();
+    visited.clear();
+    node_type root = Traits::root(ref);
+    if (root && visited.insert(root)) queue.push(root);
+  }
+  inline void end(const C* ref) { queue.clear(); }
+  inline T& get(const C* ref) { return Traits::value(queue.front()); }
+  inline bool equals(const graph_bfs_state& s) const { return current() == s.current(); }
+
+ private:
+  node_type current() const { return queue.empty() ? node_type() : queue.front(); }
+};
+
+/* * * * * STRUCTURE OF ARRAYS: * * * * */
+
+#if __cplusplus >= 201103L
+namespace detail {
+
+template <std::size_t... I>
+struct indices {};
+template <std::size_t N, std::size_t... I>
+struct make_indices : make_indices<N - 1, N - 1, I...> {};
+template <std::size_t... I>
+struct make_indices<0, I...> { typedef indices<I...> type; };
+
+}  // namespace detail
+
+// A vector keeping each field of its elements in a separate array, so
+// loops reading only some of the fields don't load the others to cache.
+//
+// Its iterators return `Ref` and `ConstRef`, aggregates of references to
+// the fields of an element, declared in the same order as `Fields`, e.g.:
+//
+//   struct point_ref { float& x; float& y; };
+//   struct point_cref { const float& x; const float& y; };
+//   typedef soa_vector<point_ref, point_cref, float, float> points;
+//
+// So loops can still use `p.x` or `it->x`, and `column<I>()` gives
+// direct access to the array of the field `I` for vectorized kernels.
+// The iterators are random access, but `Ref` can't be swapped, so they
+// can't be used with `std::sort()` or other algorithms that permute them.
+template <class Ref, class ConstRef, typename... Fields>
+class soa_vector {
+  typedef typename detail::make_indices<sizeof...(Fields)>::type all_fields;
+
+  std::tuple<std::vector<Fields>...> columns;
+  // Incremented when the iterators are invalidated:
+  std::size_t changes;
+
+  template <std::size_t... I>
+  Ref at(std::size_t i, detail::indices<I...>) {
+    Ref r = { std::get<I>(columns)[i]... };
+    return r;
+  }
+  template <std::size_t... I>
+  ConstRef at(std::size_t i, detail::indices<I...>) const {
+    ConstRef r = { std::get<I>(columns)[i]... };
+    return r;
+  }
+
+  template <std::size_t... I>
+  void push_back(detail::indices<I...>, const Fields&... values) {
+    int expand[] = { (std::get<I>(columns).push_back(values), 0)... };
+    (void)expand;
+  }
+  template <std::size_t... I>
+  void resize(detail::indices<I...>, std::size_t n) {
+    int expand[] = { (std::get<I>(columns).resize(n), 0)... };
+    (void)expand;
+  }
+  template <std::size_t... I>
+  void reserve(detail::indices<I...>, std::size_t n) {
+    int expand[] = { (std::get<I>(columns).reserve(n), 0)... };
+    (void)expand;
+  }
+
+ public:
+  template <std::size_t I>
+  struct field {
+    typedef typename std::tuple_element<I, std::tuple<Fields...> >::type type;
+  };
+
+  soa_vector() : changes(0) {}
+
+  std::size_t size() const { return std::get<0>(columns).size(); }
+  bool empty() const { return size() == 0; }
+
+  void push_back(const Fields&... values) {
+    push_back(all_fields(), values...);
+    ++changes;
+  }
+  void resize(std::size_t n) { resize(all_fields(), n); ++changes; }
+  void reserve(std::size_t n) { reserve(all_fields(), n); ++changes; }
+  void clear() { resize(0); }
+
+  Ref operator[](std::size_t i) { return at(i, all_fields()); }
+  ConstRef operator[](std::size_t i) const { return at(i, all_fields()); }
+
+  // The array of the field `I`, with `size()` elements:
+  template <std::size_t I>
+  typename field<I>::type* column() { return std::get<I>(columns).data(); }
+  template <std::size_t I>
+  const typename field<I>::type* column() const {
+    return std::get<I>(columns).data();
+  }
+  template <std::size_t I>
+  block<typename field<I>::type> column_block() {
+    return make_block(column<I>(), size());
+  }
+  template <std::size_t I>
+  block<const typename field<I>::type> column_block() const {
+    return make_block(column<I>(), size());
+  }
+
+  struct it_state {
+    std::ptrdiff_t pos;
+    inline void next(const soa_vector* ref) { ++pos; }
+    inline void prev(const soa_vector* ref) { --pos; }
+    inline void begin(const soa_vector* ref) { pos = 0; }
+    inline void end(const soa_vector* ref) { pos = ref->size(); }
+    inline Ref get(soa_vector* ref) { return (*ref)[pos]; }
+    inline ConstRef get(const soa_vector* ref) { return (*ref)[pos]; }
+    inline bool equals(const it_state& s) const { return pos == s.pos; }
+    inline void advance(const soa_vector* ref, std::ptrdiff_t n) { pos += n; }
+    inline std::ptrdiff_t distance(const soa_vector* ref, const it_state& s) const {
+      return pos - s.pos;
+    }
+    inline std::size_t generation(const soa_vector* ref) const {
+      return ref->changes;
+    }
+  };
+  // `Ref` and `ConstRef` are different types, so
+  // the macros are used one iterator at a time:
+  VGSI_SETUP_MUTABLE_ITERATOR(soa_vector, Ref, it_state)
+  VGSI_SETUP_CONST_ITERATOR(soa_vector, ConstRef, it_state)
+  typedef iterator_tpl::reverse_state<soa_vector, it_state> it_state_reversed;
+  VGSI_SETUP_MUTABLE_RITERATOR(soa_vector, Ref, it_state)
+  VGSI_SETUP_CONST_RITERATOR(soa_vector, ConstRef, it_state)
+};
+#endif
+
+/* * * * * ZIP: * * * * */
+
+#if __cplusplus >= 201103L
+template <class... Cs>
+struct zip_view;
+
+namespace detail {
+
+template <bool... B>
+struct bools {};
+template <bool... B>
+struct all_true
+  : bool_<std::is_same<bools<B..., true>, bools<true, B...> >::value> {};
+
+template <class It>
+struct is_random_access
+  : bool_<std::is_base_of<std::random_access_iterator_tag,
+            typename std::iterator_traits<It>::iterator_category>::value> {};
+
+}  // namespace detail
+
+// Used by `zip_view` to walk its containers in lockstep.
+//
+// When all the containers are random access, `end()` is the end of the
+// shortest one, so only the first iterator needs to be compared; otherwise
+// it stops as soon as any of the iterators reaches the end of its container:
+template <class... Cs>
+struct zip_state {
+  typedef typename detail::make_indices<sizeof...(Cs)>::type all;
+  typedef std::tuple<typename detail::container_iterator<Cs>::type...> iterators;
+  typedef std::tuple<typename std::iterator_traits<
+    typename detail::container_iterator<Cs>::type>::reference...> value_type;
+
+  static const bool random_access = detail::all_true<
+    detail::is_random_access<typename detail::container_iterator<Cs>::type>::value...
+  >::value;
+  static const bool contiguous = detail::all_true<
+    is_contiguous<typename detail::container_iterator<Cs>::type>::value...
+  >::value;
+
+  iterators its;
+
+  inline void next(const zip_view<Cs...>* ref) { next(all()); }
+  // Only used when `random_access` is true, since the
+  // iterators are not aligned on `end()` otherwise:
+  inline void prev(const zip_view<Cs...>* ref) { prev(all()); }
+  inline void begin(const zip_view<Cs...>* ref) { begin(ref, all()); }
+  inline void end(const zip_view<Cs...>* ref) {
+    end(ref, all(), detail::bool_<random_access>());
+  }
+  inline value_type get(const zip_view<Cs...>* ref) { return get(all()); }
+  inline bool equals(const zip_state& s) const {
+    return equals(s, all(), detail::bool_<random_access>());
+  }
+
+  // Only used when `random_access` is true:
+  inline void advance(const zip_view<Cs...>* ref, std::ptrdiff_t n) {
+    advance(n, all());
+  }
+  inline std::ptrdiff_t distance(const zip_view<Cs...>* ref,
+                                 const zip_state& s) const {
+    return std::get<0>(its) - std::get<0>(s.its);
+  }
+
+ private:
+  template <std::size_t... I>
+  void next(detail::indices<I...>) {
+    int expand[] = { (++std::get<I>(its), 0)... };
+    (void)expand;
+  }
+  template <std::size_t... I>
+  void prev(detail::indices<I...>) {
+    int expand[] = { (--std::get<I>(its), 0)... };
+    (void)expand;
+  }
+  template <std::size_t... I>
+  void advance(std::ptrdiff_t n, detail::indices<I...>) {
+    int expand[] = { (std::get<I>(its) += n, 0)... };
+    (void)expand;
+  }
+  template <std::size_t... I>
+  void begin(const zip_view<Cs...>* ref, detail::indices<I...>) {
+    its = iterators(std::get<I>(ref->containers)->begin()...);
+  }
+  template <std::size_t... I>
+  void end(const zip_view<Cs...>* ref, detail::indices<I...>, detail::bool_<false>) {
+    // (converting the sentinels, if any)
+    its = iterators(typename std::tuple_element<I, iterators>::type(
+      std::get<I>(ref->containers)->end())...);
+  }
+  template <std::size_t... I>
+  void end(const zip_view<Cs...>* ref, detail::indices<I...>, detail::bool_<true>) {
+    begin(ref, all());
+    std::ptrdiff_t sizes[] = {
+      typename std::tuple_element<I, iterators>::type(
+        std::get<I>(ref->containers)->end()) - std::get<I>(its)...
+    };
+    advance(*std::min_element(sizes, sizes + sizeof...(I)), all());
+  }
+  template <std::size_t... I>
+  value_type get(detail::indices<I...>) { return value_type(*std::get<I>(its)...); }
+  template <std::size_t... I>
+  bool equals(const zip_state& s, detail::indices<I...>, detail::bool_<false>) const {
+    bool equal = false;
+    int expand[] = { (equal = equal || std::get<I>(its) == std::get<I>(s.its), 0)... };
+    (void)expand;
+    return equal;
+  }
+  template <std::size_t... I>
+  bool equals(const zip_state& s, detail::indices<I...>, detail::bool_<true>) const {
+    return std::get<0>(its) == std::get<0>(s.its);
+  }
+};
+
+namespace detail {
+
+template <class... Cs>
+struct has_prev<zip_state<Cs...> > : bool_<zip_state<Cs...>::random_access> {};
+template <class... Cs>
+struct has_advance<zip_state<Cs...> > : bool_<zip_state<Cs...>::random_access> {};
+template <class... Cs>
+struct has_distance<zip_state<Cs...> > : bool_<zip_state<Cs...>::random_access> {};
+
+}  // namespace detail
+
+// Iterates over several containers at once, returning tuples with the
+// elements at the same position of each of them, see `zip()`:
+template <class... Cs>
+struct zip_view {
+  std::tuple<Cs*...> containers;
+
+  explicit zip_view(Cs&... cs) : containers(&cs...) {}
+
+  typedef typename zip_state<Cs...>::value_type value_type;
+  VGSI_SETUP_ITERATORS(zip_view, value_type, zip_state<Cs...>)
+};
+
+// E.g. `for (auto t : zip(keys, values)) f(std::get<0>(t), std::get<1>(t));`
+template <class... Cs>
+inline zip_view<Cs...> zip(Cs&... cs) { return zip_view<Cs...>(cs...); }
+
+namespace detail {
+
+template <class F, class It, std::size_t... I>
+inline F for_each_block(It first, It last, F f, indices<I...>, bool_<true>) {
+  f(unwrapper<typename std::tuple_element<I, decltype(first.state.its)>::type>
+      ::unwrap(std::get<I>(first.state.its))..., std::size_t(last - first));
+  return f;
+}
+
+template <class F, class It, std::size_t... I>
+inline F for_each_block(It first, It last, F f, indices<I...>, bool_<false>) {
+  for (; first != last; ++first) f(&*std::get<I>(first.state.its)..., std::size_t(1));
+  return f;
+}
+
+}  // namespace detail
+
+// Calls `f(data1, data2, ..., size)` for spans of elements at the same
+// position of each container, a single call when all of them are contiguous
+// and one call per position otherwise:
+template <class... Cs, class F>
+inline F for_each_block(zip_view<Cs...> z, F f) {
+  typedef typename zip_view<Cs...>::iterator It;
+  It first = z.begin(), last = z.end();
+  return detail::for_each_block(first, last, f,
+    typename zip_state<Cs...>::all(),
+    detail::bool_<zip_state<Cs...>::contiguous>());
+}
+#endif
+
+/* * * * * PIPELINES: * * * * */
+
+#if __cplusplus >= 201103L
+// Lazy views built with `pipe(c) | map(f) | filter(p) | take(n)`.
+//
+// Each view keeps the previous one by value and its state keeps an iterator
+// of the previous view, so iterating the last view runs a single loop over
+// the container with all the stages inlined and nothing allocated.
+//
+// The views must outlive their iterators and should not be copied while
+// iterating, since their iterators point to the view they came from.
+
+// The first view of a pipeline, iterating over `C`:
+template <class C>
+struct pipe_view {
+  typedef typename detail::container_iterator<C>::type iterator;
+  C* c;
+  iterator begin() { return c->begin(); }
+  // (converting the sentinel, if any)
+  iterator end() { return iterator(c->end()); }
+};
+
+template <class V, class F>
+struct map_view {
+  typedef typename V::iterator base_iterator;
+  typedef decltype(std::declval<F&>()(*std::declval<base_iterator&>())) value_type;
+
+  V base;
+  F f;
+
+  struct it_state {
+    base_iterator it;
+    inline void next(const map_view* ref) { ++it; }
+    inline void begin(map_view* ref) { it = ref->base.begin(); }
+    inline void end(map_view* ref) { it = ref->base.end(); }
+    inline value_type get(map_view* ref) { return ref->f(*it); }
+    inline bool equals(const it_state& s) const { return it == s.it; }
+  };
+  VGSI_SETUP_MUTABLE_ITERATOR(map_view, value_type, it_state)
+};
+
+namespace detail {
+
+// Keeps the element tested by `filter_view`, so an rvalue computed by
+// the previous stages is not computed again by `get()`:
+template <typename R>
+struct held {
+  R value;
+  void set(R v) { value = v; }
+  R get() { return value; }
+};
+template <typename R>
+struct held<R&> {
+  R* value;
+  void set(R& v) { value = &v; }
+  R& get() { return *value; }
+};
+
+}  // namespace detail
+
+template <class V, class Pred>
+struct filter_view {
+  typedef typename V::iterator base_iterator;
+  typedef typename std::iterator_traits<base_iterator>::reference value_type;
+
+  V base;
+  Pred pred;
+
+  struct it_state {
+    base_iterator it;
+    // The end of the range, so `next()` never goes past it:
+    base_iterator last;
+    detail::held<value_type> current;
+    inline void next(filter_view* ref) { ++it; skip(ref); }
+    inline void begin(filter_view* ref) {
+      it = ref->base.begin();
+      last = ref->base.end();
+      skip(ref);
+    }
+    inline void end(filter_view* ref) { it = last = ref->base.end(); }
+    inline value_type get(filter_view* ref) { return current.get(); }
+    inline bool equals(const it_state& s) const { return it == s.it; }
+   private:
+    inline void skip(filter_view* ref) {
+      for (; it != last; ++it) {
+        current.set(*it);
+        if (ref->pred(current.get())) return;
+      }
+    }
+  };
+  VGSI_SETUP_MUTABLE_ITERATOR(filter_view, value_type, it_state)
+};
+
+template <class V>
+struct take_view {
+  typedef typename V::iterator base_iterator;
+  typedef typename std::iterator_traits<base_iterator>::reference value_type;
+
+  V base;
+  std::size_t n;
+
+  // Stops after `n` elements or at the end of `base`,
+  // without moving `it` past the last element taken:
+  struct it_state {
+    base_iterator it;
+    std::size_t left;
+    inline void next(const take_view* ref) { if (--left) ++it; }
+    inline void begin(take_view* ref) { it = ref->base.begin(); left = ref->n; }
+    inline void end(take_view* ref) { it = ref->base.end(); left = 0; }
+    inline value_type get(take_view* ref) { return *it; }
+    inline bool equals(const it_state& s) const {
+      return (left == 0 && s.left == 0) || it == s.it;
+    }
+  };
+  VGSI_SETUP_MUTABLE_ITERATOR(take_view, value_type, it_state)
+};
+
+// The arguments of `operator|`, see below:
+template <class F>
+struct map_stage { F f; };
+template <class Pred>
+struct filter_stage { Pred pred; };
+struct take_stage { std::size_t n; };
+
+template <class C>
+inline pipe_view<C> pipe(C& c) { pipe_view<C> v = { &c }; return v; }
+
+// Returns `f(x)` for each element `x`:
+template <class F>
+inline map_stage<F> map(F f) { map_stage<F> s = { f }; return s; }
+
+// Keeps only the elements `x` for which `pred(x)` returns true:
+template <class Pred>
+inline filter_stage<Pred> filter(Pred pred) { filter_stage<Pred> s = { pred }; return s; }
+
+// Keeps at most the first `n` elements:
+inline take_stage take(std::size_t n) { take_stage s = { n }; return s; }
+
+template <class V, class F>
+inline map_view<V, F> operator|(const V& v, map_stage<F> s) {
+  map_view<V, F> r = { v, s.f };
+  return r;
+}
+
+template <class V, class Pred>
+inline filter_view<V, Pred> operator|(const V& v, filter_stage<Pred> s) {
+  filter_view<V, Pred> r = { v, s.pred };
+  return r;
+}
+
+template <class V>
+inline take_view<V> operator|(const V& v, take_stage s) {
+  take_view<V> r = { v, s.n };
+  return r;
+}
+#endif
+
+/* * * * * COROUTINES: * * * * */
+
+#if VGSI_COROUTINES
+// A buffer provided by the caller for the frames of the generators started
+// on this thread while a `frame_arena_scope` using it is alive. Frames are
+// allocated one after the other and the buffer is reused when all of them
+// were released. When it is full the frames go to the thread pool instead.
+class frame_arena {
+  char* buffer;
+  std::size_t capacity;
+  std::size_t offset;
+  std::size_t live;
+
+ public:
+  frame_arena(void* buffer, std::size_t capacity)
+    : buffer(static_cast<char*>(buffer)), capacity(capacity), offset(0), live(0) {}
+
+  // The bytes currently in use:
+  std::size_t used() const { return offset; }
+
+  void* allocate(std::size_t n) {
+    n = (n + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+    void* p = buffer + offset;
+    std::size_t space = capacity - offset;
+    if (!std::align(alignof(std::max_align_t), n, p, space)) return nullptr;
+    offset = static_cast<char*>(p) - buffer + n;
+    ++live;
+    return p;
+  }
+  void deallocate(void*) {
+    if (--live == 0) offset = 0;
+  }
+};
+
+namespace detail {
+
+inline frame_arena*& current_arena() {
+  static thread_local frame_arena* arena = nullptr;
+  return arena;
+}
+
+// Stored before each frame, so it is released where it came from:
+struct alignas(std::max_align_t) frame_header {
+  frame_arena* arena;
+};
+
+// Keeps the released frames of this thread, by size in steps of
+// `granularity` bytes, so starting a generator doesn't call the
+// global `operator new` once a frame of that size was released:
+class frame_pool {
+  static const std::size_t granularity = 64;
+  static const std::size_t classes = 16;
+
+  struct free_frame { free_frame* next; };
+  free_frame* free_lists[classes];
+
+ public:
+  frame_pool() : free_lists() {}
+  ~frame_pool() {
+    for (std::size_t i = 0; i < classes; ++i) {
+      while (free_lists[i]) {
+        free_frame* f = free_lists[i];
+        free_lists[i] = f->next;
+        ::operator delete(f);
+      }
+    }
+  }
+
+  static frame_pool& local() {
+    static thread_local frame_pool pool;
+    return pool;
+  }
+
+  void* allocate(std::size_t n) {
+    std::size_t c = (n - 1) / granularity;
+    if (c >= classes) return ::operator new(n);
+    if (free_frame* f = free_lists[c]) {
+      free_lists[c] = f->next;
+      return f;
+    }
+    return ::operator new((c + 1) * granularity);
+  }
+  void deallocate(void* p, std::size_t n) {
+    std::size_t c = (n - 1) / granularity;
+    if (c >= classes) return ::operator delete(p);
+    free_frame* f = static_cast<free_frame*>(p);
+    f->next = free_lists[c];
+    free_lists[c] = f;
+  }
+};
+
+inline void* allocate_frame(std::size_t n) {
+  n += sizeof(frame_header);
+  frame_arena* arena = current_arena();
+  void* p = arena ? arena->allocate(n) : nullptr;
+  if (!p) {
+    arena = nullptr;
+    p = frame_pool::local().allocate(n);
+  }
+  static_cast<frame_header*>(p)->arena = arena;
+  return static_cast<frame_header*>(p) + 1;
+}
+
+inline void deallocate_frame(void* frame, std::size_t n) {
+  frame_header* p = static_cast<frame_header*>(frame) - 1;
+  if (p->arena) return p->arena->deallocate(p);
+  frame_pool::local().deallocate(p, n + sizeof(frame_header));
+}
+
+}  // namespace detail
+
+// Makes the generators started on this thread use `arena` for their frames:
+struct frame_arena_scope {
+  frame_arena* previous;
+  explicit frame_arena_scope(frame_arena& arena)
+    : previous(detail::current_arena()) { detail::current_arena() = &arena; }
+  ~frame_arena_scope() { detail::current_arena() = previous; }
+  frame_arena_scope(const frame_arena_scope&) = delete;
+  frame_arena_scope& operator=(const frame_arena_scope&) = delete;
+};
+
+// The return type of coroutines yielding values of type `T` with
+// `co_yield`, which are iterated with `coroutine_state` below:
+template <typename T>
+class generator {
+ public:
+  typedef typename std::remove_reference<T>::type element_type;
+
+  struct promise_type {
+    element_type* value;
+    // The number of `coroutine_state`s sharing the coroutine:
+    int refs;
+
+    promise_type() : value(nullptr), refs(1) {}
+
+    generator get_return_object() {
+      return generator(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    std::suspend_always final_suspend() noexcept { return {}; }
+    // The yielded value lives until the coroutine is resumed:
+    std::suspend_always yield_value(element_type& v) noexcept {
+      value = std::addressof(v);
+      return {};
+    }
+    std::suspend_always yield_value(element_type&& v) noexcept
+      requires (!std::is_lvalue_reference<T>::value) {
+      value = std::addressof(v);
+      return {};
+    }
+    void return_void() {}
+    void unhandled_exception() { throw; }
+
+    static void* operator new(std::size_t n) { return detail::allocate_frame(n); }
+    static void operator delete(void* p, std::size_t n) { detail::deallocate_frame(p, n); }
+  };
+  typedef std::coroutine_handle<promise_type> handle;
+
+  generator(generator&& other) : h(other.h) { other.h = nullptr; }
+  generator(const generator&) = delete;
+  generator& operator=(const generator&) = delete;
+  ~generator() { if (h) h.destroy(); }
+
+  handle release() { handle r = h; h = nullptr; return r; }
+
+ private:
+  explicit generator(handle h) : h(h) {}
+  handle h;
+};
+
+// Adapts a coroutine to a state for `VGSI_SETUP_ITERATORS`, where `Walk`
+// is called with the container and returns a `generator<T>`, e.g.:
+//
+//   iterator_tpl::generator<int&> walk() { for (...) co_yield x; }
+//   typedef iterator_tpl::coroutine_state<graph, int&, &graph::walk> it_state;
+//   SETUP_MUTABLE_ITERATOR(graph, int&, it_state);
+//
+// The copies of the state share the coroutine, so they are input iterators:
+template <class C, typename T, auto Walk>
+struct coroutine_state {
+  typedef typename generator<T>::handle handle;
+  handle h;
+
+  coroutine_state() : h(nullptr) {}
+  coroutine_state(const coroutine_state& s) : h(s.h) { if (h) ++h.promise().refs; }
+  coroutine_state& operator=(const coroutine_state& s) {
+    if (s.h) ++s.h.promise().refs;
+    release();
+    h = s.h;
+    return *this;
+  }
+  ~coroutine_state() { release(); }
+
+  inline void next(const C* ref) { h.resume(); }
+  template <class R>
+  inline void begin(R* ref) {
+    release();
+    h = std::invoke(Walk, ref).release();
+    h.resume();
+  }
+  inline void end(const C* ref) { release(); }
+  template <class R>
+  inline T get(R* ref) { return static_cast<T>(*h.promise().value); }
+  inline bool equals(const coroutine_state& s) const { return done() == s.done(); }
+
+ private:
+  bool done() const { return !h || h.done(); }
+  void release() {
+    if (h && --h.promise().refs == 0) h.destroy();
+    h = nullptr;
+  }
+};
+
+namespace detail {
+
+template <class C, typename T, auto Walk>
+struct state_category<coroutine_state<C, T, Walk> > {
+  static const bool random_access = false;
+  static const bool contiguous = false;
+  typedef std::input_iterator_tag type;
+};
+
+}  // namespace detail
+#endif
+
 }  // namespace iterator_tpl
 
+#if VGSI_INSTRUMENT_ITERATORS
+#include "iterator_tpl_instrument.h"
+#endif
+
 #endif
@@ -0,0 +1,273 @@
+// MIT License
+//
+// Copyright (c) 2017 Vinícius Garcia (vingarcia00@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Optional epoch-based reclamation, so containers modified by writer
+// threads can be iterated without locks. Requires C++11 and linking
+// with the platform threads library (-pthread).
+
+#ifndef _iterator_tpl_epoch_h_
+#define _iterator_tpl_epoch_h_
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <vector>
+
+#include "iterator_tpl.h"
+
+namespace iterator_tpl {
+
+/* * * * * EPOCHS: * * * * */
+
+// Keeps the nodes removed from a container until no reader can still see them.
+//
+// Readers pin the current epoch while they iterate. Writers unlink a node
+// (so new readers can't reach it) and then `retire()` it, which advances
+// the epoch. The node is deleted once every reader pinned when it was still
+// reachable has finished, so readers never wait for writers or vice versa.
+class epoch_domain {
+ public:
+  // The number of slots for pinned epochs. Readers pinning the same epoch
+  // share a slot, and when all of them are taken new readers share the
+  // slot of an older epoch, which protects the same nodes and more:
+  static const std::size_t max_readers = 128;
+  // Retired nodes are reclaimed every `reclaim_period` retirements:
+  static const std::size_t reclaim_period = 64;
+
+ private:
+  // Each slot packs the pinned epoch with the number of readers sharing it:
+  static const unsigned count_bits = 16;
+  static const unsigned long long count_mask = (1ULL << count_bits) - 1;
+
+  // One slot per cache line, 0 if it is free:
+  struct alignas(64) slot {
+    std::atomic<unsigned long long> pinned;
+  };
+
+  struct retired {
+    void* node;
+    void (*destroy)(void* node);
+    unsigned long long epoch;
+  };
+
+  // Written by every `retire()` and read by every `pin()`, so it gets
+  // a cache line of its own (aligned on the heap since C++17):
+  alignas(64) std::atomic<unsigned long long> global;
+  char global_padding[64 - sizeof(std::atomic<unsigned long long>)];
+
+  // `new slot[]` doesn't align them before C++17, so they are
+  // placed in a larger buffer:
+  std::unique_ptr<char[]> slot_buffer;
+  slot* slots;
+  std::mutex retired_mutex;
+  std::vector<retired> retired_nodes;
+
+  template <class T>
+  static void destroy(void* node) { delete static_cast<T*>(node); }
+
+  // The oldest epoch still pinned by a reader:
+  unsigned long long oldest_pinned() const {
+    unsigned long long oldest = global.load();
+    for (std::size_t i = 0; i < max_readers; ++i) {
+      unsigned long long e = slots[i].pinned.load() >> count_bits;
+      if (e != 0 && e < oldest) oldest = e;
+    }
+    return oldest;
+  }
+
+  // Adds a reader to slot `i` if it pins an epoch `e` accepted by `fits`:
+  template <class Fits>
+  bool join(std::size_t i, Fits fits) {
+    unsigned long long p = slots[i].pinned.load();
+    while (p != 0 && fits(p >> count_bits) && (p & count_mask) != count_mask) {
+      if (slots[i].pinned.compare_exchange_weak(p, p + 1)) return true;
+    }
+    return false;
+  }
+
+  // Pins `e`, or an older epoch. Readers never wait: the slot's epoch
+  // only changes when it is free, and any epoch not newer than the
+  // current one when the reader starts protects the nodes it may see.
+  std::size_t pin_at(unsigned long long e) {
+    for (std::size_t i = 0; i < max_readers; ++i) {
+      unsigned long long expected = 0;
+      if (slots[i].pinned.compare_exchange_strong(expected, (e << count_bits) | 1)) {
+        return i;
+      }
+      if (join(i, [e](unsigned long long pinned) { return pinned == e; })) return i;
+    }
+    for (std::size_t i = 0; i < max_readers; ++i) {
+      if (join(i, [e](unsigned long long pinned) { return pinned <= e; })) return i;
+    }
+    throw std::length_error("epoch_domain: too many pinned readers");
+  }
+
+ public:
+  epoch_domain() : global(1) {
+    std::size_t space = max_readers * sizeof(slot) + alignof(slot);
+    slot_buffer.reset(new char[space]);
+    void* first = slot_buffer.get();
+    first = std::align(alignof(slot), max_readers * sizeof(slot), first, space);
+    slots = static_cast<slot*>(first);
+    for (std::size_t i = 0; i < max_readers; ++i) {
+      new (&slots[i]) slot();
+      slots[i].pinned = 0;
+    }
+  }
+  // There must be no readers left:
+  ~epoch_domain() {
+    for (std::size_t i = 0; i < retired_nodes.size(); ++i) {
+      retired_nodes[i].destroy(retired_nodes[i].node);
+    }
+  }
+
+  // Pins the current epoch, returns the slot used:
+  std::size_t pin() { return pin_at(global.load()); }
+
+  // Pins the epoch pinned by `other`, which must stay pinned meanwhile:
+  std::size_t pin_copy(std::size_t other) {
+    if (join(other, [](unsigned long long) { return true; })) return other;
+    return pin_at(slots[other].pinned.load() >> count_bits);
+  }
+
+  void unpin(std::size_t i) {
+    unsigned long long p = slots[i].pinned.load();
+    // (the last reader frees the slot)
+    while (!slots[i].pinned.compare_exchange_weak(p, (p & count_mask) == 1 ? 0 : p - 1)) {}
+  }
+
+  // Deletes `node`, already unlinked from the container,
+  // once the readers that could see it are finished:
+  template <class T>
+  void retire(T* node) {
+    retired r = { node, &destroy<T>, global.fetch_add(1) };
+    std::lock_guard<std::mutex> lock(retired_mutex);
+    retired_nodes.push_back(r);
+    if (retired_nodes.size() % reclaim_period == 0) reclaim_locked();
+  }
+
+  // Deletes the retired nodes no reader can see anymore,
+  // returns the number of nodes still waiting:
+  std::size_t reclaim() {
+    std::lock_guard<std::mutex> lock(retired_mutex);
+    reclaim_locked();
+    return retired_nodes.size();
+  }
+
+ private:
+  void reclaim_locked() {
+    unsigned long long oldest = oldest_pinned();
+    std::size_t kept = 0;
+    for (std::size_t i = 0; i < retired_nodes.size(); ++i) {
+      if (retired_nodes[i].epoch < oldest) {
+        retired_nodes[i].destroy(retired_nodes[i].node);
+      } else {
+        retired_nodes[kept++] = retired_nodes[i];
+      }
+    }
+    retired_nodes.resize(kept);
+  }
+
+  epoch_domain(const epoch_domain&);
+  epoch_domain& operator=(const epoch_domain&);
+};
+
+// Keeps an epoch of `domain` pinned while it is alive. Copies pin the same
+// epoch, so they protect the same nodes:
+class epoch_guard {
+  epoch_domain* domain;
+  std::size_t slot;
+
+ public:
+  epoch_guard() : domain(0), slot(0) {}
+  explicit epoch_guard(epoch_domain& d) : domain(&d), slot(d.pin()) {}
+  epoch_guard(const epoch_guard& other) : domain(other.domain), slot(0) {
+    if (domain) slot = domain->pin_copy(other.slot);
+  }
+  epoch_guard& operator=(const epoch_guard& other) {
+    if (this == &other) return *this;
+    std::size_t s = other.domain ? other.domain->pin_copy(other.slot) : 0;
+    release();
+    domain = other.domain;
+    slot = s;
+    return *this;
+  }
+  ~epoch_guard() { release(); }
+
+  void pin(epoch_domain& d) {
+    std::size_t s = d.pin();
+    release();
+    domain = &d;
+    slot = s;
+  }
+  void release() {
+    if (domain) domain->unpin(slot);
+    domain = 0;
+  }
+};
+
+/* * * * * EPOCH STATE ADAPTOR: * * * * */
+
+// Used by `VGSI_SETUP_EPOCH_ITERATORS`, pinning an epoch of the domain
+// returned by `ref->epochs()` from `begin()` until the iterator, and all
+// its copies, are destroyed, so the nodes it may visit are not deleted.
+// `S` must load the links between nodes atomically (with acquire order).
+template <class C, class S>
+struct epoch_state : public S {
+  epoch_guard guard;
+
+  inline void begin(const C* ref) {
+    guard.pin(ref->epochs());
+    S::begin(ref);
+  }
+  // `end()` doesn't point to any node:
+  inline void end(const C* ref) { guard.release(); S::end(ref); }
+
+  // Optional push iteration, also pinning an epoch:
+  template <class R, class F>
+  inline bool for_each(R* ref, F& f) {
+    epoch_guard pinned(ref->epochs());
+    return S::for_each(ref, f);
+  }
+};
+
+namespace detail {
+template <class C, class S>
+struct has_for_each<epoch_state<C, S> > : has_for_each<S> {};
+}  // namespace detail
+
+// Declares `iterator` and `const_iterator` pinning an epoch of the
+// `epoch_domain& epochs() const` of C while they are alive:
+#define VGSI_SETUP_EPOCH_ITERATORS(C, T, S)                     \
+  typedef iterator_tpl::epoch_state<C, S> S##_pinned;          \
+  VGSI_SETUP_ITERATORS(C, T, S##_pinned)
+
+#ifndef SETUP_EPOCH_ITERATORS
+#define SETUP_EPOCH_ITERATORS(C, T, S) VGSI_SETUP_EPOCH_ITERATORS(C, T, S)
+#endif
+
+}  // namespace iterator_tpl
+
+#endif
@@ -0,0 +1,156 @@
+// MIT License
+//
+// Copyright (c) 2017 Vinícius Garcia (vingarcia00@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Optional instrumentation of the iterators, see `iterator_tpl::instrumentation`.
+// Included by `iterator_tpl.h` when `VGSI_INSTRUMENT_ITERATORS` is not 0, or
+// include it to instrument only some states. Requires C++11.
+
+#ifndef _iterator_tpl_instrument_h_
+#define _iterator_tpl_instrument_h_
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <typeinfo>
+
+#if defined(__GNUG__)
+#include <cxxabi.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "iterator_tpl.h"
+
+namespace iterator_tpl {
+
+/* * * * * ITERATOR STATS: * * * * */
+
+// The counters of the iterators of one container and state type:
+struct iterator_stats {
+  std::string container;
+  std::string state;
+  std::atomic<unsigned long long> calls[detail::probe_op_count];
+  std::atomic<unsigned long long> sampled[detail::probe_op_count];
+  std::atomic<unsigned long long> cycles[detail::probe_op_count];
+  iterator_stats* next;
+
+  static const char* op_name(int op) {
+    static const char* names[] = {
+      "next", "prev", "get", "equals", "advance", "distance", "at_end"
+    };
+    return names[op];
+  }
+
+  // The stats of the iterators of `C` using the state `S`:
+  template <class C, class S>
+  static iterator_stats& of() {
+    static iterator_stats s(typeid(C).name(), typeid(S).name());
+    return s;
+  }
+
+  // All the stats created so far:
+  static std::atomic<iterator_stats*>& first() {
+    static std::atomic<iterator_stats*> head(nullptr);
+    return head;
+  }
+
+  iterator_stats(const char* container, const char* state)
+    : container(demangle(container)), state(demangle(state)), next(nullptr) {
+    for (int op = 0; op < detail::probe_op_count; ++op) {
+      calls[op] = sampled[op] = cycles[op] = 0;
+    }
+    next = first().load();
+    while (!first().compare_exchange_weak(next, this)) {}
+  }
+
+  static std::string demangle(const char* mangled) {
+    std::string result = mangled;
+#if defined(__GNUG__)
+    int status = 0;
+    char* name = abi::__cxa_demangle(mangled, nullptr, nullptr, &status);
+    if (status == 0) result = name;
+    std::free(name);
+#endif
+    return result;
+  }
+
+  // Writes the stats of every instrumented container to `out`,
+  // an `std::ostream` or similar:
+  template <class Out>
+  static void report(Out& out) {
+    for (iterator_stats* s = first().load(); s; s = s->next) {
+      out << s->container << " (" << s->state << "):\n";
+      for (int op = 0; op < detail::probe_op_count; ++op) {
+        if (s->calls[op] == 0) continue;
+        out << "  " << op_name(op) << ": " << s->calls[op] << " calls";
+        if (s->sampled[op]) {
+          out << ", " << double(s->cycles[op]) / s->sampled[op] << " cycles/call";
+        }
+        out << "\n";
+      }
+    }
+  }
+};
+
+namespace detail {
+
+inline unsigned long long read_cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+template <class C, class S>
+struct probe<C, S, count_calls> {
+  explicit probe(probe_op op) {
+    iterator_stats::of<C, S>().calls[op].fetch_add(1, std::memory_order_relaxed);
+  }
+};
+
+template <class C, class S>
+struct probe<C, S, count_cycles> {
+  probe_op op;
+  unsigned long long start;
+
+  explicit probe(probe_op op) : op(op), start(0) {
+    static thread_local unsigned calls[probe_op_count] = {};
+    iterator_stats::of<C, S>().calls[op].fetch_add(1, std::memory_order_relaxed);
+    if (++calls[op] % cycles_sample_rate == 0) start = read_cycles();
+  }
+  ~probe() {
+    if (start == 0) return;
+    iterator_stats& s = iterator_stats::of<C, S>();
+    s.cycles[op].fetch_add(read_cycles() - start, std::memory_order_relaxed);
+    s.sampled[op].fetch_add(1, std::memory_order_relaxed);
+  }
+};
+
+}  // namespace detail
+
+}  // namespace iterator_tpl
+
+#endif
@@ -0,0 +1,201 @@
+// MIT License
+//
+// Copyright (c) 2017 Vinícius Garcia (vingarcia00@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Optional read-only containers over memory-mapped record files.
+// Requires C++11 and a POSIX system (mmap).
+
+#ifndef _iterator_tpl_mmap_h_
+#define _iterator_tpl_mmap_h_
+
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "iterator_tpl.h"
+
+namespace iterator_tpl {
+
+/* * * * * MAPPED FILES: * * * * */
+
+// A whole file mapped read-only in memory. The pages are loaded by the
+// kernel on demand and shared with the page cache, so opening it is
+// instant regardless of its size. Throws `std::system_error` on failure.
+class mapped_file {
+  const char* bytes;
+  std::size_t length;
+
+ public:
+  // How the pages will be accessed, see `madvise()`:
+  enum access_pattern { normal, sequential, random };
+
+  explicit mapped_file(const std::string& path, access_pattern access = sequential)
+    : bytes(0), length(0) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw std::system_error(errno, std::generic_category(), path);
+    struct stat st;
+    if (::fstat(fd, &st) < 0) {
+      int error = errno;
+      ::close(fd);
+      throw std::system_error(error, std::generic_category(), path);
+    }
+    length = st.st_size;
+    // (mapping 0 bytes is an error)
+    if (length > 0) {
+      void* p = ::mmap(0, length, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p == MAP_FAILED) {
+        int error = errno;
+        ::close(fd);
+        throw std::system_error(error, std::generic_category(), path);
+      }
+      bytes = static_cast<const char*>(p);
+    }
+    // The mapping stays valid after closing the file:
+    ::close(fd);
+    advise(access);
+  }
+  ~mapped_file() {
+    if (bytes) ::munmap(const_cast<char*>(bytes), length);
+  }
+
+  // Changes the read-ahead of the kernel for the next accesses:
+  void advise(access_pattern access) {
+    if (!bytes) return;
+    int advice = access == sequential ? MADV_SEQUENTIAL
+               : access == random ? MADV_RANDOM : MADV_NORMAL;
+    ::madvise(const_cast<char*>(bytes), length, advice);
+  }
+
+  const char* data() const { return bytes; }
+  std::size_t size() const { return length; }
+
+ private:
+  mapped_file(const mapped_file&);
+  mapped_file& operator=(const mapped_file&);
+};
+
+/* * * * * FIXED-LENGTH RECORDS: * * * * */
+
+// A file of consecutive `T` records, e.g. written with `fwrite(&t, sizeof(T), n, f)`.
+// `T` must be trivially copyable. The iterators return references into the
+// mapping, so reading a record never copies it, and are contiguous random
+// access iterators (so `copy_fast()`, `for_each_block()` and the parallel
+// algorithms work directly on the mapped pages).
+template <typename T>
+class fixed_record_file : public mapped_file {
+ public:
+  explicit fixed_record_file(const std::string& path,
+                             mapped_file::access_pattern access = mapped_file::sequential)
+    : mapped_file(path, access) {}
+
+  // Trailing bytes not filling a whole record are ignored:
+  std::size_t size() const { return mapped_file::size() / sizeof(T); }
+  bool empty() const { return size() == 0; }
+  const T* records() const { return reinterpret_cast<const T*>(data()); }
+  const T& operator[](std::size_t i) const { return records()[i]; }
+
+  struct it_state {
+    std::ptrdiff_t pos;
+    inline void next(const fixed_record_file* ref) { ++pos; }
+    inline void prev(const fixed_record_file* ref) { --pos; }
+    inline void begin(const fixed_record_file* ref) { pos = 0; }
+    inline void end(const fixed_record_file* ref) { pos = ref->size(); }
+    inline const T& get(const fixed_record_file* ref) { return ref->records()[pos]; }
+    inline bool equals(const it_state& s) const { return pos == s.pos; }
+    inline void advance(const fixed_record_file* ref, std::ptrdiff_t n) { pos += n; }
+    inline std::ptrdiff_t distance(const fixed_record_file* ref, const it_state& s) const {
+      return pos - s.pos;
+    }
+    inline const T* data(const fixed_record_file* ref) { return ref->records() + pos; }
+  };
+  VGSI_SETUP_CONST_ITERATOR(fixed_record_file, const T&, it_state);
+  typedef iterator_tpl::reverse_state<fixed_record_file, it_state> it_state_reversed;
+  VGSI_SETUP_CONST_RITERATOR(fixed_record_file, const T&, it_state);
+};
+
+/* * * * * DELIMITED RECORDS: * * * * */
+
+// A file of variable-length records ended by `delimiter`, e.g. the lines of
+// a text file. The last record may omit its delimiter. The iterators return
+// `block<const char>`s pointing into the mapping (without the delimiter),
+// and are bidirectional, so the file can also be read backwards.
+class delimited_record_file : public mapped_file {
+  char delimiter;
+
+ public:
+  explicit delimited_record_file(const std::string& path, char delimiter = '\n',
+                                 mapped_file::access_pattern access = mapped_file::sequential)
+    : mapped_file(path, access), delimiter(delimiter) {}
+
+  // The position and length of a record, `pos` is -1 before the
+  // first record (for the reverse iterators) and `size()` at the end:
+  struct it_state {
+    std::ptrdiff_t pos;
+    std::size_t len;
+
+    inline void next(const delimited_record_file* ref) {
+      pos = pos < 0 ? 0 : std::min(pos + len + 1, ref->size());
+      measure(ref);
+    }
+    inline void prev(const delimited_record_file* ref) {
+      const char* bytes = ref->data();
+      if (pos == 0) {
+        pos = -1;
+        len = 0;
+        return;
+      }
+      // Where the previous record ends, before its delimiter if it has one:
+      std::size_t last = pos;
+      if (bytes[last - 1] == ref->delimiter) --last;
+      std::size_t first = last;
+      while (first > 0 && bytes[first - 1] != ref->delimiter) --first;
+      pos = first;
+      len = last - first;
+    }
+    inline void begin(const delimited_record_file* ref) { pos = 0; measure(ref); }
+    inline void end(const delimited_record_file* ref) { pos = ref->size(); len = 0; }
+    inline block<const char> get(const delimited_record_file* ref) {
+      return make_block(ref->data() + pos, len);
+    }
+    inline bool equals(const it_state& s) const { return pos == s.pos; }
+
+   private:
+    inline void measure(const delimited_record_file* ref) {
+      std::size_t left = ref->size() - pos;
+      const void* found = left ? std::memchr(ref->data() + pos, ref->delimiter, left) : 0;
+      len = found ? static_cast<const char*>(found) - (ref->data() + pos) : left;
+    }
+  };
+  VGSI_SETUP_CONST_ITERATOR(delimited_record_file, block<const char>, it_state);
+  typedef iterator_tpl::reverse_state<delimited_record_file, it_state> it_state_reversed;
+  VGSI_SETUP_CONST_RITERATOR(delimited_record_file, block<const char>, it_state);
+};
+
+}  // namespace iterator_tpl
+
+#endif
@@ -0,0 +1,383 @@
+// MIT License
+//
+// Copyright (c) 2017 Vinícius Garcia (vingarcia00@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Optional parallel algorithms for containers using `iterator_tpl.h`.
+// Requires C++11 and linking with the platform threads library (-pthread).
+
+#ifndef _iterator_tpl_parallel_h_
+#define _iterator_tpl_parallel_h_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "iterator_tpl.h"
+
+namespace iterator_tpl {
+
+/* * * * * THREAD POOL: * * * * */
+
+// A small work-stealing thread pool.
+//
+// Each call to `run()` distributes its tasks evenly between the
+// threads of the pool, the calling thread included, and threads
+// that run out of tasks steal half of the remaining tasks of
+// another thread, so uneven tasks still keep every core busy.
+class thread_pool {
+  // Indexes of the tasks not yet taken from a thread:
+  struct queue {
+    std::mutex mutex;
+    std::size_t begin;
+    std::size_t end;
+    queue() : begin(0), end(0) {}
+  };
+
+  // The type-erased function of the current `run()`:
+  struct job {
+    void (*call)(void* task, std::size_t i);
+    void* task;
+  };
+
+  std::unique_ptr<queue[]> queues;
+  std::vector<std::thread> workers;
+  unsigned threads;
+
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable done;
+  std::size_t generation;
+  unsigned active;
+  bool stopping;
+
+  job current;
+  std::atomic<std::size_t> remaining;
+
+  // The first exception thrown by the tasks of the current `run()`,
+  // the tasks not started yet are skipped after it:
+  std::exception_ptr error;
+  std::atomic<bool> failed;
+
+  // Only one `run()` at a time:
+  std::mutex run_mutex;
+
+  static bool& inside_pool() {
+    static thread_local bool inside = false;
+    return inside;
+  }
+
+  template <class F>
+  static void call(void* task, std::size_t i) { (*static_cast<F*>(task))(i); }
+
+  bool pop(unsigned id, std::size_t& i) {
+    queue& q = queues[id];
+    std::lock_guard<std::mutex> lock(q.mutex);
+    if (q.begin == q.end) return false;
+    i = q.begin++;
+    return true;
+  }
+
+  bool steal(unsigned id, std::size_t& i) {
+    for (unsigned k = 1; k < threads; ++k) {
+      queue& victim = queues[(id + k) % threads];
+      std::size_t begin, end;
+      {
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (victim.begin == victim.end) continue;
+        begin = victim.begin + (victim.end - victim.begin) / 2;
+        end = victim.end;
+        victim.end = begin;
+      }
+      queue& own = queues[id];
+      std::lock_guard<std::mutex> lock(own.mutex);
+      own.begin = begin + 1;
+      own.end = end;
+      i = begin;
+      return true;
+    }
+    return false;
+  }
+
+  void drain(unsigned id) {
+    std::size_t i;
+    while (pop(id, i) || steal(id, i)) {
+      if (!failed) {
+        try {
+          current.call(current.task, i);
+        } catch (...) {
+          std::lock_guard<std::mutex> lock(mutex);
+          if (!error) error = std::current_exception();
+          failed = true;
+        }
+      }
+      if (remaining.fetch_sub(1) == 1) {
+        std::lock_guard<std::mutex> lock(mutex);
+        done.notify_all();
+      }
+    }
+  }
+
+  void work(unsigned id) {
+    inside_pool() = true;
+    std::size_t seen = 0;
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!stopping && generation == seen) wake.wait(lock);
+        if (stopping) return;
+        seen = generation;
+        ++active;
+      }
+      drain(id);
+      std::lock_guard<std::mutex> lock(mutex);
+      if (--active == 0) done.notify_all();
+    }
+  }
+
+ public:
+  // By default uses one thread per core:
+  explicit thread_pool(unsigned threads = 0)
+    : threads(threads ? threads : std::thread::hardware_concurrency()),
+      generation(0), active(0), stopping(false), remaining(0), failed(false) {
+    if (this->threads == 0) this->threads = 1;
+    queues.reset(new queue[this->threads]);
+    for (unsigned id = 1; id < this->threads; ++id) {
+      workers.push_back(std::thread(&thread_pool::work, this, id));
+    }
+  }
+
+  ~thread_pool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (std::size_t i = 0; i < workers.size(); ++i) workers[i].join();
+  }
+
+  // The shared pool used by default by the parallel algorithms:
+  static thread_pool& instance() {
+    static thread_pool pool;
+    return pool;
+  }
+
+  // The number of threads, including the one calling `run()`:
+  unsigned size() const { return threads; }
+
+  // Calls `task(i)` for each `i` in `[0, count)` and waits for all of them.
+  // Nested calls from inside a task run sequentially on the calling thread.
+  // If a task throws, the tasks not started yet are skipped and `run()`
+  // rethrows the first exception once the running ones finished:
+  template <class F>
+  void run(std::size_t count, F& task) {
+    if (count == 0) return;
+    if (threads == 1 || inside_pool()) {
+      for (std::size_t i = 0; i < count; ++i) task(i);
+      return;
+    }
+
+    std::lock_guard<std::mutex> serial(run_mutex);
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      current.call = &thread_pool::call<F>;
+      current.task = &task;
+      remaining = count;
+      failed = false;
+      for (unsigned id = 0; id < threads; ++id) {
+        std::lock_guard<std::mutex> qlock(queues[id].mutex);
+        queues[id].begin = count * id / threads;
+        queues[id].end = count * (id + 1) / threads;
+      }
+      ++generation;
+    }
+    wake.notify_all();
+
+    inside_pool() = true;
+    drain(0);
+    inside_pool() = false;
+
+    // Wait for the tasks still running and for the workers to go back to
+    // sleep, so the next `run()` can safely replace `current`:
+    std::unique_lock<std::mutex> lock(mutex);
+    while (remaining != 0 || active != 0) done.wait(lock);
+    if (error) {
+      std::exception_ptr e = error;
+      error = nullptr;
+      std::rethrow_exception(e);
+    }
+  }
+
+ private:
+  thread_pool(const thread_pool&);
+  thread_pool& operator=(const thread_pool&);
+};
+
+/* * * * * RANGE SPLITTING: * * * * */
+
+namespace detail {
+
+VGSI_DEFINE_HAS_MEMBER(split);
+
+// `split()` describes the forward order of `S`:
+template <class C, class S>
+struct has_split<reverse_state<C, S> > : bool_<false> {};
+
+template <class It>
+struct split_traits {
+  static const bool has_split = false;
+  static const bool random_access = false;
+};
+
+template <class C, class T, class S>
+struct split_traits<iterator<C,T,S> > {
+  static const bool has_split = detail::has_split<S>::value;
+  static const bool random_access = state_category<S>::random_access;
+};
+
+template <class C, class T, class S>
+struct split_traits<const_iterator<C,T,S> > {
+  static const bool has_split = detail::has_split<S>::value;
+  static const bool random_access = state_category<S>::random_access;
+};
+
+// Using the optional `split()` function of the state:
+template <class It, class RandomAccess>
+inline std::vector<It> split(It first, It last, std::size_t parts,
+                             bool_<true>, RandomAccess) {
+  std::vector<It> bounds;
+  // The state should return the boundaries of at most
+  // `parts` sub-ranges, starting with `lo` and ending with `hi`:
+  auto states = first.state.split(first.ref, first.state, last.state, parts);
+  for (std::size_t i = 0; i < states.size(); ++i) {
+    bounds.push_back(first);
+    bounds.back().state = states[i];
+  }
+  return bounds;
+}
+
+// Using `advance()` and `distance()`:
+template <class It>
+inline std::vector<It> split(It first, It last, std::size_t parts,
+                             bool_<false>, bool_<true>) {
+  std::vector<It> bounds;
+  std::ptrdiff_t size = last - first;
+  if (size < static_cast<std::ptrdiff_t>(parts)) parts = size ? size : 1;
+  for (std::size_t i = 0; i < parts; ++i) {
+    bounds.push_back(first + static_cast<std::ptrdiff_t>(size * i / parts));
+  }
+  bounds.push_back(last);
+  return bounds;
+}
+
+// Not splittable, so it runs as a single part:
+template <class It>
+inline std::vector<It> split(It first, It last, std::size_t,
+                             bool_<false>, bool_<false>) {
+  std::vector<It> bounds;
+  bounds.push_back(first);
+  bounds.push_back(last);
+  return bounds;
+}
+
+template <class It>
+inline std::vector<It> split(It first, It last, std::size_t parts) {
+  return split(first, last, parts,
+    bool_<split_traits<It>::has_split>(),
+    bool_<split_traits<It>::random_access>());
+}
+
+template <class It, class F>
+struct for_each_task {
+  const std::vector<It>& bounds;
+  F& f;
+  void operator()(std::size_t i) {
+    for (It it = bounds[i]; it != bounds[i+1]; ++it) f(*it);
+  }
+};
+
+template <class It, class V, class Op>
+struct reduce_task {
+  const std::vector<It>& bounds;
+  Op& op;
+  std::vector<V>& partials;
+  std::vector<char>& empty;
+  void operator()(std::size_t i) {
+    It it = bounds[i];
+    if (it == bounds[i+1]) { empty[i] = 1; return; }
+    V acc = *it;
+    for (++it; it != bounds[i+1]; ++it) acc = op(acc, *it);
+    partials[i] = acc;
+  }
+};
+
+// How many parts to split a range for `pool`, a few per
+// thread so there is something left to steal:
+inline std::size_t parts_for(const thread_pool& pool) {
+  return pool.size() == 1 ? 1 : 4 * pool.size();
+}
+
+}  // namespace detail
+
+/* * * * * PARALLEL ALGORITHMS: * * * * */
+
+// Calls `f(x)` for each element `x` of `c` from several threads.
+//
+// The range is split with the optional `split()` function of the
+// state, or with `advance()` and `distance()` if it is a random access
+// range. Other containers are iterated sequentially.
+template <class C, class F>
+inline void parallel_for_each(C& c, F f,
+                              thread_pool& pool = thread_pool::instance()) {
+  typedef typename detail::container_iterator<C>::type It;
+  It first = c.begin(), last = c.end();
+  std::vector<It> bounds = detail::split(first, last, detail::parts_for(pool));
+  detail::for_each_task<It, F> task = { bounds, f };
+  pool.run(bounds.size() - 1, task);
+}
+
+// Returns `init op x1 op x2 ... op xn` for the elements `xi` of `c`,
+// combining sub-ranges from several threads, so `op` must be associative.
+template <class C, class V, class Op>
+inline V parallel_reduce(C& c, V init, Op op,
+                         thread_pool& pool = thread_pool::instance()) {
+  typedef typename detail::container_iterator<C>::type It;
+  It first = c.begin(), last = c.end();
+  std::vector<It> bounds = detail::split(first, last, detail::parts_for(pool));
+  std::size_t parts = bounds.size() - 1;
+  std::vector<V> partials(parts, init);
+  std::vector<char> empty(parts, 0);
+  detail::reduce_task<It, V, Op> task = { bounds, op, partials, empty };
+  pool.run(parts, task);
+
+  for (std::size_t i = 0; i < parts; ++i) {
+    if (!empty[i]) init = op(init, partials[i]);
+  }
+  return init;
+}
+
+}  // namespace iterator_tpl
+
+#endif
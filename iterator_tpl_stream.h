@@ -0,0 +1,142 @@
+// MIT License
+//
+// Copyright (c) 2017 Vinícius Garcia (vingarcia00@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Optional input containers reading delimited records from a stream.
+// Requires C++11 and a POSIX system (read).
+
+#ifndef _iterator_tpl_stream_h_
+#define _iterator_tpl_stream_h_
+
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <system_error>
+#include <vector>
+
+#include <unistd.h>
+
+#include "iterator_tpl.h"
+
+namespace iterator_tpl {
+
+/* * * * * DELIMITER SEARCH: * * * * */
+
+// Returns the address of the first `delimiter` in `data[0..size)`, or null.
+// C libraries implement `std::memchr()` with the widest vector instructions
+// of the CPU. It can be used to split the fields of the records below too:
+inline const char* find_delimiter(const char* data, std::size_t size, char delimiter) {
+  return static_cast<const char*>(std::memchr(data, delimiter, size));
+}
+
+/* * * * * DELIMITED STREAMS: * * * * */
+
+// Reads the records ended by `delimiter` from the file descriptor `fd`,
+// e.g. the lines of a pipe or a socket, in chunks of `chunk_size` bytes.
+//
+// The iterators are input iterators returning `block<const char>`s that point
+// into the internal buffer, without the delimiter, and are only valid until the
+// iterator is incremented. Records longer than the buffer make it grow.
+// Throws `std::system_error` if reading fails. The descriptor is not closed.
+class delimited_stream {
+  int fd;
+  char delimiter;
+  std::size_t chunk_size;
+  std::vector<char> buffer;
+  // The bytes of the buffer not returned yet:
+  std::size_t first;
+  std::size_t last;
+  block<const char> current;
+  bool started;
+  bool eof;
+
+  // Reads more bytes after `last`, returns false at the end of the stream:
+  bool fill() {
+    if (eof) return false;
+    if (first > 0) {
+      std::memmove(&buffer[0], &buffer[first], last - first);
+      last -= first;
+      first = 0;
+    }
+    if (buffer.size() - last < chunk_size) buffer.resize(last + chunk_size);
+    ssize_t n;
+    do {
+      n = ::read(fd, &buffer[last], chunk_size);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) throw std::system_error(errno, std::generic_category(), "read");
+    if (n == 0) eof = true;
+    last += n;
+    return n > 0;
+  }
+
+ public:
+  explicit delimited_stream(int fd, char delimiter = '\n',
+                            std::size_t chunk_size = 1 << 16)
+    : fd(fd), delimiter(delimiter), chunk_size(chunk_size),
+      buffer(chunk_size), first(0), last(0), started(false), eof(false) {
+    current = make_block<const char>(0, 0);
+  }
+
+  // Moves to the next record, returns false at the end of the stream:
+  bool read_record() {
+    started = true;
+    std::size_t searched = first;
+    for (;;) {
+      const char* found =
+        find_delimiter(&buffer[0] + searched, last - searched, delimiter);
+      if (found) {
+        std::size_t end = found - &buffer[0];
+        current = make_block<const char>(&buffer[first], end - first);
+        first = end + 1;
+        return true;
+      }
+      // (`fill()` moves the unread bytes to the start of the buffer)
+      searched = last - first;
+      if (!fill()) break;
+    }
+    // The last record may omit its delimiter:
+    if (first == last) {
+      current = make_block<const char>(0, 0);
+      return false;
+    }
+    current = make_block<const char>(&buffer[first], last - first);
+    first = last;
+    return true;
+  }
+
+  struct it_state {
+    static const bool single_pass = true;
+    bool done;
+    inline void next(delimited_stream* ref) { done = !ref->read_record(); }
+    // The stream can only be read once, so `begin()` doesn't rewind it:
+    inline void begin(delimited_stream* ref) {
+      done = ref->started ? ref->current.data == 0 : !ref->read_record();
+    }
+    inline void end(delimited_stream* ref) { done = true; }
+    inline block<const char> get(delimited_stream* ref) { return ref->current; }
+    inline bool equals(const it_state& s) const { return done == s.done; }
+  };
+  VGSI_SETUP_MUTABLE_ITERATOR(delimited_stream, block<const char>, it_state);
+};
+
+}  // namespace iterator_tpl
+
+#endif
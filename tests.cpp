@@ -1,6 +1,66 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fcntl.h>
 #include <iostream>
+#include <iterator>
+#include <mutex>
+#include <thread>
+#include <numeric>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
 #include <vector>
+
+// Make checked iterators throw instead of aborting, so they can be tested:
+#define VGSI_ASSERT(COND, MSG) ((COND) ? (void)0 : throw std::logic_error(MSG))
 #include "iterator_tpl.h"
+#include "iterator_tpl_epoch.h"
+#include "iterator_tpl_instrument.h"
+#include "iterator_tpl_mmap.h"
+#include "iterator_tpl_parallel.h"
+#include "iterator_tpl_stream.h"
+
+struct block_sum {
+  int sum;
+  int blocks;
+  void operator()(const int* data, size_t size) {
+    for (size_t i = 0; i < size; ++i) sum += data[i];
+    ++blocks;
+  }
+};
+
+struct plus {
+  long operator()(long a, long b) const { return a + b; }
+};
+
+struct double_in_place {
+  void operator()(int& x) const { x *= 2; }
+};
+
+struct throw_on {
+  int value;
+  void operator()(int& x) const {
+    if (x == value) throw std::runtime_error("throw_on");
+  }
+};
+
+// Counts the elements visited by threads other than `caller`, slowly
+// enough for the other threads of the pool to get some of them:
+struct count_elsewhere {
+  std::thread::id caller;
+  std::atomic<int>* count;
+  void operator()(int& x) const {
+    if (x % 1000 == 0) std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    if (std::this_thread::get_id() != caller) ++*count;
+  }
+};
+
+struct twice {
+  int operator()(int x) const { return 2 * x; }
+};
 
 #define ASSERT(COND) if ((COND) == 0) {\
   std::cout << std::string("Assertion error for cond: " #COND)\
@@ -44,6 +104,574 @@ struct myClass_rvalue {
   SETUP_REVERSE_ITERATORS(myClass_rvalue, float, it_state);
 };
 
+// This class's state provides `advance()`, `distance()` and `data()`
+// so its iterators are contiguous random access iterators:
+struct myClass_random {
+  std::vector<int> vec;
+
+  struct it_state {
+    int pos;
+    inline void next(const myClass_random* ref) { ++pos; }
+    inline void prev(const myClass_random* ref) { --pos; }
+    inline void begin(const myClass_random* ref) { pos = 0; }
+    inline void end(const myClass_random* ref) { pos = ref->vec.size(); }
+    inline int& get(myClass_random* ref) { return ref->vec[pos]; }
+    inline const int& get(const myClass_random* ref) const { return ref->vec[pos]; }
+    inline bool equals(const it_state& s) const { return pos == s.pos; }
+    inline void advance(const myClass_random* ref, std::ptrdiff_t n) { pos += n; }
+    inline std::ptrdiff_t distance(const myClass_random* ref, const it_state& s) const {
+      return pos - s.pos;
+    }
+    inline int* data(myClass_random* ref) { return ref->vec.data() + pos; }
+    inline const int* data(const myClass_random* ref) { return ref->vec.data() + pos; }
+  };
+  SETUP_ITERATORS(myClass_random, int&, it_state);
+  SETUP_REVERSE_ITERATORS(myClass_random, int&, it_state);
+};
+
+// This class stores its elements in fixed size pages
+// and allows them to be iterated one page at a time:
+struct myClass_paged {
+  std::vector<std::vector<int> > pages;
+
+  struct it_state {
+    size_t page;
+    size_t pos;
+    inline void next(const myClass_paged* ref) {
+      if (++pos == ref->pages[page].size()) { ++page; pos = 0; }
+    }
+    inline void begin(const myClass_paged* ref) { page = 0; pos = 0; }
+    inline void end(const myClass_paged* ref) { page = ref->pages.size(); pos = 0; }
+    inline int& get(myClass_paged* ref) { return ref->pages[page][pos]; }
+    inline const int& get(const myClass_paged* ref) { return ref->pages[page][pos]; }
+    inline bool equals(const it_state& s) const { return page == s.page && pos == s.pos; }
+    inline iterator_tpl::block<int> next_block(myClass_paged* ref) {
+      int* data = &ref->pages[page][pos];
+      size_t size = ref->pages[page].size() - pos;
+      ++page; pos = 0;
+      return iterator_tpl::make_block(data, size);
+    }
+    inline iterator_tpl::block<const int> next_block(const myClass_paged* ref) {
+      const int* data = &ref->pages[page][pos];
+      size_t size = ref->pages[page].size() - pos;
+      ++page; pos = 0;
+      return iterator_tpl::make_block(data, size);
+    }
+    // Splits `[lo, hi)` at the start of the pages:
+    inline std::vector<it_state> split(const myClass_paged* ref, const it_state& lo,
+                                       const it_state& hi, size_t parts) const {
+      std::vector<it_state> bounds(1, lo);
+      size_t pages = hi.page - lo.page;
+      for (size_t i = 1; i < parts && i < pages; ++i) {
+        it_state s = { lo.page + pages * i / parts, 0 };
+        if (s.page > bounds.back().page) bounds.push_back(s);
+      }
+      bounds.push_back(hi);
+      return bounds;
+    }
+  };
+  SETUP_ITERATORS(myClass_paged, int&, it_state);
+};
+
+struct point {
+  int x;
+  int y;
+};
+
+// References to the fields of a point kept in separate arrays:
+struct point_ref {
+  int& x;
+  int& y;
+};
+struct point_cref {
+  const int& x;
+  const int& y;
+};
+typedef iterator_tpl::soa_vector<point_ref, point_cref, int, int> points;
+
+// The iterators of this class compute each value,
+// counting how many times they did it:
+struct myClass_computed {
+  std::vector<int> vec;
+  mutable int computed;
+  myClass_computed() : computed(0) {}
+
+  struct it_state {
+    int pos;
+    inline void next(const myClass_computed* ref) { ++pos; }
+    inline void prev(const myClass_computed* ref) { --pos; }
+    inline void begin(const myClass_computed* ref) { pos = 0; }
+    inline void end(const myClass_computed* ref) { pos = ref->vec.size(); }
+    inline point get(const myClass_computed* ref) {
+      ++ref->computed;
+      point p = { ref->vec[pos], -ref->vec[pos] };
+      return p;
+    }
+    inline bool equals(const it_state& s) const { return pos == s.pos; }
+  };
+  SETUP_CACHED_ITERATORS(myClass_computed, point, it_state);
+  SETUP_REVERSE_ITERATORS(myClass_computed, point, it_state_cached);
+};
+
+// A linked list whose state knows when it reached the end,
+// so `end()` returns a sentinel on C++17:
+struct myClass_list {
+  struct node {
+    int value;
+    node* next;
+  };
+  node* head;
+  myClass_list() : head(0) {}
+  ~myClass_list() {
+    while (head) { node* n = head->next; delete head; head = n; }
+  }
+  void push_front(int value) {
+    node* n = new node;
+    n->value = value;
+    n->next = head;
+    head = n;
+  }
+
+  struct it_state {
+    node* current;
+    inline void next(const myClass_list* ref) { current = current->next; }
+    inline void begin(const myClass_list* ref) { current = ref->head; }
+    inline void end(const myClass_list* ref) { current = 0; }
+    inline int& get(myClass_list* ref) { return current->value; }
+    inline const int& get(const myClass_list* ref) { return current->value; }
+    inline bool equals(const it_state& s) const { return current == s.current; }
+    inline bool at_end(const myClass_list* ref) const { return current == 0; }
+  };
+  SETUP_ITERATORS(myClass_list, int&, it_state);
+};
+
+// A directed graph, whose nodes may have several parents and form cycles:
+struct myClass_graph {
+  struct node {
+    int value;
+    std::vector<node*> edges;
+  };
+  std::vector<node*> nodes;
+  explicit myClass_graph(int count) {
+    for (int i = 0; i < count; ++i) {
+      node* n = new node;
+      n->value = i;
+      nodes.push_back(n);
+    }
+  }
+  ~myClass_graph() {
+    for (size_t i = 0; i < nodes.size(); ++i) delete nodes[i];
+  }
+  void connect(int from, int to) { nodes[from]->edges.push_back(nodes[to]); }
+
+  struct traits {
+    typedef node* node_type;
+    static node* root(const myClass_graph* ref) { return ref->nodes.empty() ? 0 : ref->nodes[0]; }
+    static std::size_t child_count(node* n) { return n->edges.size(); }
+    static node* child(node* n, std::size_t i) { return n->edges[i]; }
+    static int& value(node* n) { return n->value; }
+  };
+  // (small buffers, to test larger graphs too)
+  typedef iterator_tpl::graph_dfs_state<myClass_graph, int, traits, 2> it_state;
+  typedef iterator_tpl::graph_bfs_state<myClass_graph, int, traits, 2> bfs;
+  SETUP_ITERATORS(myClass_graph, int&, it_state);
+};
+
+// A linked list of strings whose elements can be moved out:
+struct myClass_strings {
+  struct node {
+    std::string value;
+    node* next;
+  };
+  node* head;
+  myClass_strings() : head(0) {}
+  ~myClass_strings() {
+    while (head) { node* n = head->next; delete head; head = n; }
+  }
+  void push_front(const std::string& value) {
+    node* n = new node;
+    n->value = value;
+    n->next = head;
+    head = n;
+  }
+
+  struct it_state {
+    node* current;
+    inline void next(const myClass_strings* ref) { current = current->next; }
+    inline void begin(const myClass_strings* ref) { current = ref->head; }
+    inline void end(const myClass_strings* ref) { current = 0; }
+    inline std::string& get(myClass_strings* ref) { return current->value; }
+    inline const std::string& get(const myClass_strings* ref) { return current->value; }
+    inline bool equals(const it_state& s) const { return current == s.current; }
+    inline void drain(myClass_strings* ref) {
+      ref->head = current->next;
+      delete current;
+      current = ref->head;
+    }
+  };
+  SETUP_ITERATORS(myClass_strings, std::string&, it_state);
+  SETUP_MOVE_ITERATORS(myClass_strings, std::string&, it_state);
+  SETUP_DRAIN_ITERATORS(myClass_strings, std::string&, it_state);
+};
+
+// A container of separately allocated elements, whose addresses are
+// stored in an array, so the state can find the address of the element
+// `k` steps ahead without waiting for the ones in between:
+template <int Distance>
+struct myClass_prefetched {
+  std::vector<int*> items;
+  // The calls to `prefetch_address()` and the last `k` it received:
+  mutable int prefetches;
+  mutable int last_k;
+  myClass_prefetched() : prefetches(0), last_k(0) {}
+  ~myClass_prefetched() {
+    for (size_t i = 0; i < items.size(); ++i) delete items[i];
+  }
+  void push_back(int value) { items.push_back(new int(value)); }
+
+  struct it_state {
+    size_t pos;
+    inline void next(const myClass_prefetched* ref) { ++pos; }
+    inline void begin(const myClass_prefetched* ref) { pos = 0; }
+    inline void end(const myClass_prefetched* ref) { pos = ref->items.size(); }
+    inline int& get(myClass_prefetched* ref) { return *ref->items[pos]; }
+    inline const int& get(const myClass_prefetched* ref) { return *ref->items[pos]; }
+    inline bool equals(const it_state& s) const { return pos == s.pos; }
+    inline const int* prefetch_address(const myClass_prefetched* ref, int k) const {
+      ++ref->prefetches;
+      ref->last_k = k;
+      return pos + k < ref->items.size() ? ref->items[pos + k] : 0;
+    }
+  };
+  SETUP_PREFETCHING_ITERATORS(myClass_prefetched, int&, it_state, Distance);
+};
+
+// A binary search tree whose state can also push its elements
+// recursively, without the explicit stack used by `next()`:
+struct myClass_tree {
+  struct node {
+    int value;
+    node* left;
+    node* right;
+  };
+  node* root;
+  // The number of traversals done by `for_each()`:
+  mutable int pushed;
+  myClass_tree() : root(0), pushed(0) {}
+  ~myClass_tree() { destroy(root); }
+  static void destroy(node* n) {
+    if (!n) return;
+    destroy(n->left);
+    destroy(n->right);
+    delete n;
+  }
+  void insert(int value) {
+    node** n = &root;
+    while (*n) n = value < (*n)->value ? &(*n)->left : &(*n)->right;
+    node new_node = { value, 0, 0 };
+    *n = new node(new_node);
+  }
+
+  struct traits {
+    typedef node* node_type;
+    static node* root(const myClass_tree* ref) { return ref->root; }
+    static std::size_t child_count(node* n) { return 2; }
+    static node* child(node* n, std::size_t i) { return i ? n->right : n->left; }
+    static int& value(node* n) { return n->value; }
+  };
+  typedef iterator_tpl::preorder_state<myClass_tree, int, traits, 4> preorder;
+  typedef iterator_tpl::postorder_state<myClass_tree, int, traits, 4> postorder;
+  typedef iterator_tpl::level_order_state<myClass_tree, int, traits, 4> level_order;
+  typedef iterator_tpl::level_order_state<myClass_tree, int, traits, 2> narrow_level_order;
+
+  struct it_state : iterator_tpl::inorder_state<myClass_tree, int, traits, 4> {
+    template <class F>
+    inline bool for_each(const myClass_tree* ref, F& f) {
+      ++ref->pushed;
+      return visit(ref->root, f);
+    }
+   private:
+    template <class F>
+    static bool visit(node* n, F& f) {
+      return !n || (visit(n->left, f) && f(n->value) && visit(n->right, f));
+    }
+  };
+  SETUP_ITERATORS(myClass_tree, int&, it_state);
+};
+
+struct counting_is_odd {
+  int* calls;
+  bool operator()(int x) const { ++*calls; return x % 2 != 0; }
+};
+
+struct int_sum {
+  int sum;
+  void operator()(int x) { sum += x; }
+};
+
+#if VGSI_COROUTINES
+// Flattens the rows with a coroutine instead of writing the state:
+struct myClass_rows {
+  std::vector<std::vector<int> > rows;
+
+  iterator_tpl::generator<int&> walk() {
+    for (std::vector<int>& row : rows) {
+      for (int& x : row) co_yield x;
+    }
+  }
+  iterator_tpl::generator<int> squares() const {
+    for (const std::vector<int>& row : rows) {
+      for (int x : row) co_yield x * x;
+    }
+  }
+  typedef iterator_tpl::coroutine_state<myClass_rows, int&, &myClass_rows::walk> it_state;
+  typedef iterator_tpl::coroutine_state<myClass_rows, int, &myClass_rows::squares>
+    squares_state;
+  SETUP_MUTABLE_ITERATOR(myClass_rows, int&, it_state);
+  SETUP_CONST_ITERATOR(myClass_rows, int, squares_state);
+};
+#endif
+
+// A linked list whose nodes are removed by a writer while other threads
+// iterate over it, counting the nodes deleted so far:
+struct myClass_concurrent {
+  static std::atomic<int> deleted;
+  struct node {
+    int value;
+    std::atomic<node*> next;
+    ~node() { ++deleted; }
+  };
+  std::atomic<node*> head;
+  std::mutex writer;
+  mutable iterator_tpl::epoch_domain domain;
+
+  myClass_concurrent() : head(nullptr) {}
+  ~myClass_concurrent() {
+    for (node* n = head; n;) { node* next = n->next; delete n; n = next; }
+  }
+  iterator_tpl::epoch_domain& epochs() const { return domain; }
+
+  void push_front(int value) {
+    std::lock_guard<std::mutex> lock(writer);
+    node* n = new node;
+    n->value = value;
+    n->next.store(head.load());
+    head.store(n, std::memory_order_release);
+  }
+  bool pop_front() {
+    std::lock_guard<std::mutex> lock(writer);
+    node* n = head.load();
+    if (!n) return false;
+    head.store(n->next.load());
+    domain.retire(n);
+    return true;
+  }
+
+  struct it_state {
+    node* current;
+    inline void next(const myClass_concurrent* ref) {
+      current = current->next.load(std::memory_order_acquire);
+    }
+    inline void begin(const myClass_concurrent* ref) {
+      current = ref->head.load(std::memory_order_acquire);
+    }
+    inline void end(const myClass_concurrent* ref) { current = 0; }
+    inline const int& get(const myClass_concurrent* ref) { return current->value; }
+    inline bool equals(const it_state& s) const { return current == s.current; }
+    template <class F>
+    inline bool for_each(const myClass_concurrent* ref, F& f) {
+      for (node* n = ref->head.load(std::memory_order_acquire); n;
+           n = n->next.load(std::memory_order_acquire)) {
+        if (!f(n->value)) return false;
+      }
+      return true;
+    }
+  };
+  SETUP_EPOCH_ITERATORS(myClass_concurrent, const int&, it_state);
+};
+std::atomic<int> myClass_concurrent::deleted(0);
+
+// A forward-only container that knows how many elements are left,
+// counting the calls to `next()`:
+struct myClass_sized {
+  std::vector<int> vec;
+  mutable int steps;
+  myClass_sized() : steps(0) {}
+
+  struct it_state {
+    size_t pos;
+    inline void next(const myClass_sized* ref) { ++pos; ++ref->steps; }
+    inline void begin(const myClass_sized* ref) { pos = 0; }
+    inline void end(const myClass_sized* ref) { pos = ref->vec.size(); }
+    inline int& get(myClass_sized* ref) { return ref->vec[pos]; }
+    inline const int& get(const myClass_sized* ref) { return ref->vec[pos]; }
+    inline bool equals(const it_state& s) const { return pos == s.pos; }
+    inline std::ptrdiff_t remaining(const myClass_sized* ref) const {
+      return ref->vec.size() - pos;
+    }
+  };
+  SETUP_ITERATORS(myClass_sized, int&, it_state);
+  SETUP_SIZE(myClass_sized, it_state);
+};
+
+// The state is a pointer to the current element and doesn't use `ref`
+// after `begin()` and `end()`, so the iterators don't keep it:
+struct myClass_compact {
+  std::vector<int> vec;
+
+  struct it_state {
+    static const bool stateless_ref = true;
+    const int* p;
+    inline void next(const myClass_compact* ref) { ++p; }
+    inline void prev(const myClass_compact* ref) { --p; }
+    inline void begin(const myClass_compact* ref) { p = ref->vec.data(); }
+    inline void end(const myClass_compact* ref) { p = ref->vec.data() + ref->vec.size(); }
+    inline const int& get(const myClass_compact* ref) { return *p; }
+    inline bool equals(const it_state& s) const { return p == s.p; }
+  };
+  SETUP_ITERATORS(myClass_compact, const int&, it_state);
+  SETUP_REVERSE_ITERATORS(myClass_compact, const int&, it_state);
+};
+
+// A row-major grid, iterated in tiles or in Morton order:
+struct myClass_grid {
+  std::vector<int> cells;
+  int w, h, d;
+  int width() const { return w; }
+  int height() const { return h; }
+  int depth() const { return d; }
+  int* data() { return cells.data(); }
+  const int* data() const { return cells.data(); }
+
+  typedef iterator_tpl::tiled_state<myClass_grid, int, 4, 2> tiles;
+  typedef iterator_tpl::tiled_state<myClass_grid, int, 1, 1, 1,
+                                    iterator_tpl::morton_tiles> morton;
+  typedef iterator_tpl::tiled_state<myClass_grid, int, 2, 2, 2,
+                                    iterator_tpl::morton_tiles> morton_cubes;
+  SETUP_ITERATORS(myClass_grid, int&, tiles);
+};
+
+// Instrument only the iterators of `myClass_list`:
+namespace iterator_tpl {
+template <>
+struct instrumentation<myClass_list::it_state> {
+  static const int level = count_cycles;
+};
+}
+
+// This class counts the changes that invalidate its iterators:
+struct myClass_checked {
+  std::vector<int> vec;
+  size_t changes;
+  myClass_checked() : changes(0) {}
+  void push_back(int value) { vec.push_back(value); ++changes; }
+
+  struct it_state {
+    static const bool checked_end = true;
+    int pos;
+    inline void next(const myClass_checked* ref) { ++pos; }
+    inline void begin(const myClass_checked* ref) { pos = 0; }
+    inline void end(const myClass_checked* ref) { pos = ref->vec.size(); }
+    inline int& get(myClass_checked* ref) { return ref->vec[pos]; }
+    inline bool equals(const it_state& s) const { return pos == s.pos; }
+    inline size_t generation(const myClass_checked* ref) const { return ref->changes; }
+  };
+  SETUP_MUTABLE_ITERATOR(myClass_checked, int&, it_state);
+};
+
+template <class F>
+bool throws(F f) {
+  try {
+    f();
+  } catch (const std::logic_error&) {
+    return true;
+  }
+  return false;
+}
+
+bool throws_system_error(const char* path) {
+  try {
+    iterator_tpl::mapped_file f(path);
+  } catch (const std::system_error&) {
+    return true;
+  }
+  return false;
+}
+
+struct zip_block {
+  int calls;
+  int sum;
+  void operator()(const int* a, int* b, size_t size) {
+    for (size_t i = 0; i < size; ++i) sum += a[i] * b[i];
+    ++calls;
+  }
+  void operator()(const int* a, int* b, float* c, size_t size) {
+    for (size_t i = 0; i < size; ++i) sum += a[i] * b[i] + c[i];
+    ++calls;
+  }
+};
+
+struct is_odd {
+  bool operator()(int x) const { return x % 2 != 0; }
+};
+
+// Same as `is_odd` but tests up to 64 elements at once:
+struct is_odd_batched : is_odd {
+  unsigned long long mask(const int* data, size_t size) const {
+    return iterator_tpl::batch_mask(data, size, is_odd());
+  }
+};
+
+// These classes only iterate over the odd elements:
+template <class Pred>
+struct myClass_filtered {
+  std::vector<int> vec;
+
+  typedef myClass_filtered<Pred> self;
+  struct it_state {
+    int pos;
+    inline void next(const self* ref) { ++pos; }
+    inline void begin(const self* ref) { pos = 0; }
+    inline void end(const self* ref) { pos = ref->vec.size(); }
+    inline int& get(self* ref) { return ref->vec[pos]; }
+    inline const int& get(const self* ref) const { return ref->vec[pos]; }
+    inline bool equals(const it_state& s) const { return pos == s.pos; }
+    inline void advance(const self* ref, std::ptrdiff_t n) { pos += n; }
+    inline std::ptrdiff_t distance(const self* ref, const it_state& s) const {
+      return pos - s.pos;
+    }
+    inline const int* data(const self* ref) const { return ref->vec.data() + pos; }
+  };
+  SETUP_FILTERED_ITERATORS(self, int&, it_state, Pred);
+};
+
+template <class Pred>
+void test_filter() {
+  myClass_filtered<Pred> f1;
+  const myClass_filtered<Pred>& f2 = f1;
+  ASSERT(f1.begin() == f1.end());
+
+  for (int size = 1; size < 300; size += 37) {
+    f1.vec.clear();
+    for (int i = 0; i < size; ++i) f1.vec.push_back(i % 5 == 0 || i % 67 == 1 ? i : 2 * i);
+    std::vector<int> expected;
+    std::copy_if(f1.vec.begin(), f1.vec.end(), std::back_inserter(expected), is_odd());
+    std::vector<int> filtered(f2.begin(), f2.end());
+    ASSERT(filtered == expected);
+  }
+
+  // When no element passes the filter:
+  f1.vec.assign(200, 2);
+  ASSERT(f1.begin() == f1.end());
+  ASSERT(f2.begin() == f2.end());
+
+  // Only the last one:
+  f1.vec.back() = 3;
+  ASSERT(*f1.begin() == 3 && ++f1.begin() == f1.end());
+  *f1.begin() = 5;
+  ASSERT(f1.vec.back() == 5);
+}
+
 int main() {
   myClass c1;
   c1.vec.push_back(1.0);
@@ -144,5 +772,657 @@ int main() {
   ASSERT(*(++c2.begin()) == 2);
   ASSERT(*(c2.begin()++) == 1);
 
+  // Testing the iterator categories:
+  typedef std::iterator_traits<myClass::iterator> traits;
+  typedef std::iterator_traits<myClass_random::const_iterator> rtraits;
+  typedef std::iterator_traits<myClass_random::reverse_iterator> rrtraits;
+  ASSERT((std::is_same<traits::iterator_category, std::bidirectional_iterator_tag>::value));
+  ASSERT((std::is_same<rtraits::iterator_category, std::random_access_iterator_tag>::value));
+  ASSERT((std::is_same<rrtraits::iterator_category, std::random_access_iterator_tag>::value));
+
+  // Testing random access operators:
+  myClass_random r1;
+  const myClass_random& r2 = r1;
+  for (int i = 0; i < 10; ++i) r1.vec.push_back((i * 7) % 10);
+  ASSERT(r1.end() - r1.begin() == 10);
+  ASSERT(std::distance(r2.begin(), r2.end()) == 10);
+  ASSERT(*(r1.begin() + 3) == 1);
+  ASSERT(*(3 + r2.begin()) == 1);
+  ASSERT(r2.begin()[3] == 1);
+  ASSERT(*(r1.end() - 1) == 3);
+  ASSERT(r1.begin() < r1.end() && r1.end() > r1.begin());
+  ASSERT(r1.begin() <= r1.begin() && r1.begin() >= r1.begin());
+  ASSERT(*(r1.rbegin() + 1) == 6);
+  ASSERT(r1.rend() - r1.rbegin() == 10);
+
+  std::sort(r1.begin(), r1.end());
+  for (int i = 0; i < 10; ++i) ASSERT(r1.vec[i] == i);
+  ASSERT(std::lower_bound(r2.begin(), r2.end(), 4) - r2.begin() == 4);
+  std::sort(r1.rbegin(), r1.rend());
+  ASSERT(r1.vec[0] == 9 && r1.vec[9] == 0);
+
+  // Testing contiguous iterators:
+  ASSERT(iterator_tpl::is_contiguous<myClass_random::iterator>::value);
+  ASSERT(iterator_tpl::is_contiguous<myClass_random::const_iterator>::value);
+  ASSERT(!iterator_tpl::is_contiguous<myClass_random::reverse_iterator>::value);
+  ASSERT(!iterator_tpl::is_contiguous<myClass::iterator>::value);
+  ASSERT(r1.end().data() == r1.vec.data() + 10);
+  ASSERT(r1.end().operator->() == r1.vec.data() + 10);
+
+  std::vector<int> copied(10);
+  ASSERT(iterator_tpl::copy_fast(r2.begin(), r2.end(), copied.begin()) == copied.end());
+  ASSERT(iterator_tpl::equal_fast(r2.begin(), r2.end(), copied.begin()));
+  ASSERT(iterator_tpl::equal_fast(copied.begin(), copied.end(), r1.begin()));
+  iterator_tpl::fill_fast(r1.begin() + 5, r1.end(), 0);
+  ASSERT(!iterator_tpl::equal_fast(r2.begin(), r2.end(), copied.begin()));
+  ASSERT(iterator_tpl::copy_fast(copied.rbegin(), copied.rend(), r1.begin()) == r1.end());
+  ASSERT(r1.vec[0] == 0 && r1.vec[9] == 9);
+  ASSERT(iterator_tpl::copy_fast(r1.rbegin(), r1.rend(), copied.begin()) == copied.end());
+  ASSERT(copied[0] == 9 && copied[9] == 0);
+  {
+    // Unqualified calls found through ADL are not ambiguous:
+    using std::copy;
+    using std::equal;
+    ASSERT(copy(r2.begin(), r2.end(), copied.begin()) == copied.end());
+    ASSERT(equal(r2.begin(), r2.end(), copied.begin()));
+  }
+
+  // Testing block iteration:
+  myClass_paged p1;
+  const myClass_paged& p2 = p1;
+  for (int i = 0; i < 3; ++i) p1.pages.push_back(std::vector<int>(4, i + 1));
+  block_sum bsum = { 0, 0 };
+  bsum = iterator_tpl::for_each_block(p2, bsum);
+  ASSERT(bsum.sum == 24 && bsum.blocks == 3);
+  iterator_tpl::transform_block(p1, twice());
+  ASSERT(p1.pages[2][3] == 6);
+  std::vector<int> doubled(12);
+  ASSERT(iterator_tpl::transform_block(p2, doubled.begin(), twice()) == doubled.end());
+  ASSERT(doubled[0] == 4 && doubled[11] == 12);
+
+  // Without `next_block()` each element is a block:
+  bsum.sum = bsum.blocks = 0;
+  bsum = iterator_tpl::for_each_block(r2, bsum);
+  ASSERT(bsum.sum == 45 && bsum.blocks == 10);
+
+  // Testing parallel algorithms:
+  iterator_tpl::thread_pool pool(4);
+  myClass_random big;
+  for (int i = 0; i < 10000; ++i) big.vec.push_back(i);
+  ASSERT(iterator_tpl::parallel_reduce(big, 5L, plus(), pool) == 49995005L);
+  iterator_tpl::parallel_for_each(big, double_in_place(), pool);
+  ASSERT(iterator_tpl::parallel_reduce(big, 0L, plus(), pool) == 2 * 49995000L);
+  ASSERT(iterator_tpl::parallel_reduce(c2, 0L, plus()) == 6L);
+  for (int i = 3; i < 100; ++i) p1.pages.push_back(std::vector<int>(i % 7 + 1, 1));
+  ASSERT(iterator_tpl::parallel_reduce(p2, 0L, plus(), pool) ==
+         std::accumulate(p2.begin(), p2.end(), 0L));
+
+  myClass_random none;
+  ASSERT(iterator_tpl::parallel_reduce(none, 7L, plus(), pool) == 7L);
+
+  // Exceptions of the tasks are rethrown by `run()`, from the part of the
+  // calling thread (the first one) and from the parts of the others:
+  for (int value = 0; value < 20000; value += 19998) {
+    bool thrown = false;
+    throw_on thrower = { value };
+    try {
+      iterator_tpl::parallel_for_each(big, thrower, pool);
+    } catch (const std::runtime_error&) {
+      thrown = true;
+    }
+    ASSERT(thrown);
+  }
+  // And the pool still runs in parallel afterwards:
+  std::atomic<int> elsewhere(0);
+  count_elsewhere counter = { std::this_thread::get_id(), &elsewhere };
+  iterator_tpl::parallel_for_each(big, counter, pool);
+  ASSERT(elsewhere > 0);
+  ASSERT(iterator_tpl::parallel_reduce(big, 0L, plus(), pool) == 2 * 49995000L);
+
+  // Testing filtered iterators:
+  test_filter<is_odd>();
+  test_filter<is_odd_batched>();
+  ASSERT(sizeof(myClass_filtered<is_odd_batched>::it_state_filtered) >
+         sizeof(myClass_filtered<is_odd>::it_state_filtered));
+
+  // Testing sentinels:
+  myClass_list l1;
+  const myClass_list& l2 = l1;
+  ASSERT(l1.begin() == l1.end() && l2.end() == l2.begin());
+  for (int i = 1; i <= 3; ++i) l1.push_front(i);
+  int lsum = 0;
+  for (int& v : l1) lsum += v;
+  for (const int& v : l2) lsum += v;
+  ASSERT(lsum == 12);
+  ASSERT(l1.begin() != l1.end() && l2.cend() != l2.cbegin());
+  myClass_list::iterator lend = l1.end();
+  ASSERT(std::find(l1.begin(), lend, 2) != lend);
+  ASSERT(std::find(l2.begin(), myClass_list::const_iterator(l2.end()), 4) == l2.end());
+#if __cplusplus >= 201703L
+  ASSERT((!std::is_same<decltype(l1.end()), myClass_list::iterator>::value));
+#endif
+
+  // Testing prefetching iterators:
+  myClass_prefetched<2> pf;
+  for (int i = 0; i < 10; ++i) pf.push_back(i);
+  ASSERT(std::accumulate(pf.begin(), pf.end(), 0) == 45);
+  ASSERT(pf.prefetches == 10 && pf.last_k == 2);
+  ASSERT(*std::find(pf.begin(), pf.end(), 3) == 3 && pf.prefetches == 13);
+
+  // Testing iterators without the container pointer:
+  myClass_compact mc;
+  for (int i = 1; i <= 4; ++i) mc.vec.push_back(i);
+  ASSERT(std::accumulate(mc.begin(), mc.end(), 0) == 10 && *mc.rbegin() == 4);
+  ASSERT(*std::find(mc.cbegin(), mc.cend(), 3) == 3);
+  ASSERT(sizeof(myClass_compact::iterator) == sizeof(const int*) +
+         (VGSI_CHECKED_ITERATORS ? sizeof(void*) + sizeof(size_t) : 0));
+  ASSERT(std::is_trivially_copyable<myClass_compact::const_iterator>::value);
+
+  // Testing sized ranges:
+  myClass_sized sz;
+  for (int i = 0; i < 100; ++i) sz.vec.push_back(i);
+  ASSERT(sz.size() == 100 && !sz.empty() && iterator_tpl::range_size(sz) == 100);
+  ASSERT(iterator_tpl::sized_distance(++sz.begin(), sz.end()) == 99 && sz.steps == 1);
+  ASSERT((std::is_same<std::iterator_traits<myClass_sized::iterator>::iterator_category,
+                       std::forward_iterator_tag>::value));
+  std::vector<int> appended(1, -1);
+  iterator_tpl::append(appended, sz);
+  ASSERT(appended.size() == 101 && appended.capacity() == 101 && appended[100] == 99);
+  ASSERT(sz.steps == 1 + 100);
+  ASSERT(iterator_tpl::range_size(l1) == 3 && iterator_tpl::range_size(appended) == 101);
+  {
+    using std::distance;
+    // (unqualified calls found through ADL are not ambiguous)
+    ASSERT(distance(sz.begin(), sz.end()) == 100);
+  }
+
+  // Testing internal iteration:
+  myClass_tree t1;
+  const myClass_tree& t2 = t1;
+  int keys[] = { 4, 2, 6, 1, 3, 5 };
+  for (int i = 0; i < 6; ++i) t1.insert(keys[i]);
+  std::vector<int> inorder(t2.begin(), t2.end());
+  ASSERT(std::is_sorted(inorder.begin(), inorder.end()) && inorder.size() == 6);
+  int_sum tsum = { 0 };
+  ASSERT(iterator_tpl::for_each(t1, tsum).sum == 21 && t1.pushed == 1);
+  int pred_calls = 0;
+  counting_is_odd odd_counter = { &pred_calls };
+  ASSERT(iterator_tpl::any_of(t2, odd_counter) && pred_calls == 1 && t1.pushed == 2);
+  int* found = iterator_tpl::find_if(t1, is_odd());
+  ASSERT(found && *found == 1);
+  *found = 0;
+  ASSERT(*iterator_tpl::find_if(t2, is_odd()) == 3 && t1.pushed == 4);
+  // Falls back to the iterators:
+  ASSERT(iterator_tpl::find_if(l1, is_odd()) == &*l1.begin());
+  const std::vector<int> evens(3, 2);
+  ASSERT(!iterator_tpl::any_of(evens, is_odd()));
+  ASSERT(iterator_tpl::for_each(l2, tsum).sum == 6);
+
+  // Testing tree traversal:
+  typedef iterator_tpl::iterator<myClass_tree, int&, myClass_tree::preorder> preorder_iterator;
+  typedef iterator_tpl::iterator<myClass_tree, int&, myClass_tree::postorder> postorder_iterator;
+  typedef iterator_tpl::iterator<myClass_tree, int&, myClass_tree::level_order> level_iterator;
+  std::vector<int> pre(preorder_iterator::begin(&t1), preorder_iterator::end(&t1));
+  std::vector<int> post(postorder_iterator::begin(&t1), postorder_iterator::end(&t1));
+  std::vector<int> levels(level_iterator::begin(&t1), level_iterator::end(&t1));
+  int pre_order[] = { 4, 2, 0, 3, 6, 5 };
+  int post_order[] = { 0, 3, 2, 5, 6, 4 };
+  int level_order[] = { 4, 2, 6, 0, 3, 5 };
+  ASSERT(pre.size() == 6 && std::equal(pre.begin(), pre.end(), pre_order));
+  ASSERT(post.size() == 6 && std::equal(post.begin(), post.end(), post_order));
+  ASSERT(levels.size() == 6 && std::equal(levels.begin(), levels.end(), level_order));
+  myClass_tree empty_tree;
+  ASSERT(empty_tree.begin() == empty_tree.end());
+  ASSERT(postorder_iterator::begin(&empty_tree) == postorder_iterator::end(&empty_tree));
+  // Deeper trees than the inline stack:
+  myClass_tree chain;
+  for (int i = 99; i >= 0; --i) chain.insert(i);
+  myClass_tree::iterator deep = chain.begin();
+  ASSERT(*deep == 0 && deep.state.stack.spilled());
+  myClass_tree::iterator deep_copy = deep++;
+  ASSERT(*deep_copy == 0 && *deep == 1 && deep_copy.state.stack.spilled());
+  int chain_sum = 0;
+  for (int v : chain) chain_sum += v;
+  ASSERT(chain_sum == 4950);
+  std::vector<int> chain_post(postorder_iterator::begin(&chain), postorder_iterator::end(&chain));
+  ASSERT(chain_post.size() == 100 && chain_post[0] == 0 && chain_post[99] == 99);
+  ASSERT(!t1.begin().state.stack.spilled());
+  // Queues wider than their inline buffer, after it wrapped around:
+  typedef iterator_tpl::iterator<myClass_tree, int&, myClass_tree::narrow_level_order>
+    narrow_iterator;
+  narrow_iterator nit = narrow_iterator::begin(&t1);
+  ASSERT(!nit.state.queue.spilled());
+  ++nit;
+  ++nit;
+  ASSERT(*nit == 6 && nit.state.queue.spilled());
+  narrow_iterator nit_copy = nit;
+  narrow_iterator nit_moved = std::move(nit);
+  ASSERT(nit == narrow_iterator::end(&t1) && nit_copy.state.queue.spilled());
+  std::vector<int> narrow(nit_moved, narrow_iterator::end(&t1));
+  ASSERT(narrow.size() == 4 && std::equal(narrow.begin(), narrow.end(), level_order + 2));
+  nit = std::move(nit_copy);
+  ASSERT(std::vector<int>(nit, narrow_iterator::end(&t1)) == narrow);
+  nit_copy = narrow_iterator::begin(&t1);
+  nit_copy = nit_moved;
+  ASSERT(std::vector<int>(nit_copy, narrow_iterator::end(&t1)) == narrow);
+
+  // Testing graph traversal:
+  typedef iterator_tpl::iterator<myClass_graph, int&, myClass_graph::bfs> bfs_iterator;
+  myClass_graph g4(4);
+  g4.connect(0, 1);
+  g4.connect(0, 2);
+  g4.connect(1, 3);
+  g4.connect(2, 3);
+  g4.connect(3, 0);
+  g4.connect(3, 3);
+  std::vector<int> dfs(g4.begin(), g4.end());
+  std::vector<int> bfs(bfs_iterator::begin(&g4), bfs_iterator::end(&g4));
+  int dfs_order[] = { 0, 1, 3, 2 };
+  int bfs_order[] = { 0, 1, 2, 3 };
+  ASSERT(dfs.size() == 4 && std::equal(dfs.begin(), dfs.end(), dfs_order));
+  ASSERT(bfs.size() == 4 && std::equal(bfs.begin(), bfs.end(), bfs_order));
+  myClass_graph g0(0);
+  ASSERT(g0.begin() == g0.end() && bfs_iterator::begin(&g0) == bfs_iterator::end(&g0));
+  // Larger graphs than the inline buffers:
+  myClass_graph ring(100);
+  for (int i = 0; i < 100; ++i) {
+    ring.connect(i, (i + 1) % 100);
+    ring.connect(i, i * 7 % 100);
+  }
+  myClass_graph::iterator git = ring.begin();
+  for (int i = 0; i < 50; ++i) ++git;
+  ASSERT(git.state.visited.spilled());
+  myClass_graph::iterator git_copy = git;
+  ASSERT(std::vector<int>(git_copy, ring.end()) == std::vector<int>(git, ring.end()));
+  std::vector<int> ring_dfs(ring.begin(), ring.end());
+  std::vector<int> ring_bfs(bfs_iterator::begin(&ring), bfs_iterator::end(&ring));
+  ASSERT(ring_dfs.size() == 100 && std::accumulate(ring_dfs.begin(), ring_dfs.end(), 0) == 4950);
+  ASSERT(ring_bfs.size() == 100 && std::accumulate(ring_bfs.begin(), ring_bfs.end(), 0) == 4950);
+  ASSERT(ring_bfs[1] == 1 && ring_bfs[2] == 2 && ring_bfs[3] == 7);
+  myClass_graph::iterator git_moved = std::move(git_copy);
+  ASSERT(git_moved == git && git_copy == ring.end());
+
+#if VGSI_COROUTINES
+  // Testing coroutine states:
+  myClass_rows g1;
+  const myClass_rows& g2 = g1;
+  ASSERT(g1.begin() == g1.end() && g2.begin() == g2.end());
+  g1.rows.resize(4);
+  g1.rows[0].push_back(1);
+  g1.rows[2].push_back(2);
+  g1.rows[2].push_back(3);
+  for (int& x : g1) x += 1;
+  ASSERT(std::accumulate(g2.begin(), g2.end(), 0) == 4 + 9 + 16);
+  myClass_rows::iterator rit = g1.begin();
+  // The copies share the coroutine, so `rit++` returns the value it left:
+  myClass_rows::iterator::postfix_type rcopy = rit++;
+  ASSERT(*rit == 3 && *rcopy == 2);
+  ASSERT(*rit++ == 3 && *rit == 4);
+  ASSERT((std::is_same<std::iterator_traits<myClass_rows::iterator>::iterator_category,
+                       std::input_iterator_tag>::value));
+  alignas(std::max_align_t) char arena_buffer[1024];
+  iterator_tpl::frame_arena arena(arena_buffer, sizeof(arena_buffer));
+  {
+    iterator_tpl::frame_arena_scope scope(arena);
+    myClass_rows::const_iterator first = g2.begin();
+    ASSERT(arena.used() > 0 && *first == 4);
+  }
+  ASSERT(arena.used() == 0);
+#endif
+
+  // Testing mapped record files:
+  const char* records_path = "tests_records.tmp";
+  int written[] = { 10, 20, 30, 40 };
+  std::FILE* rf = std::fopen(records_path, "wb");
+  std::fwrite(written, sizeof(int), 4, rf);
+  std::fputc('x', rf);
+  std::fclose(rf);
+  {
+    iterator_tpl::fixed_record_file<int> fixed(records_path);
+    ASSERT(fixed.size() == 4 && fixed.end() - fixed.begin() == 4);
+    ASSERT(std::accumulate(fixed.begin(), fixed.end(), 0) == 100);
+    ASSERT(*fixed.rbegin() == 40 && fixed.begin()[2] == 30);
+    ASSERT(&*fixed.begin() == fixed.records());
+    fixed.advise(iterator_tpl::mapped_file::random);
+  }
+  rf = std::fopen(records_path, "wb");
+  std::fputs("ab\n\ncde", rf);
+  std::fclose(rf);
+  {
+    iterator_tpl::delimited_record_file lines(records_path);
+    std::vector<std::string> forward, backward;
+    for (iterator_tpl::block<const char> b : lines) forward.push_back(std::string(b.data, b.size));
+    for (auto it = lines.rbegin(); it != lines.rend(); ++it) {
+      backward.push_back(std::string(it->data, it->size));
+    }
+    ASSERT(forward.size() == 3 && forward[0] == "ab" && forward[1] == "" && forward[2] == "cde");
+    ASSERT(std::equal(forward.rbegin(), forward.rend(), backward.begin()));
+    ASSERT(backward.size() == 3);
+  }
+
+  // Testing delimited streams:
+  rf = std::fopen(records_path, "wb");
+  std::fputs("first line\n\na much longer line than the chunks\nlast", rf);
+  std::fclose(rf);
+  for (size_t chunk = 4; chunk <= 4096; chunk *= 32) {
+    int fd = open(records_path, O_RDONLY);
+    iterator_tpl::delimited_stream stream(fd, '\n', chunk);
+    std::vector<std::string> streamed;
+    for (iterator_tpl::block<const char> b : stream) streamed.push_back(std::string(b.data, b.size));
+    close(fd);
+    ASSERT(streamed.size() == 4 && streamed[1] == "" && streamed[3] == "last");
+    ASSERT(streamed[2] == "a much longer line than the chunks");
+    ASSERT(stream.begin() == stream.end());
+  }
+  {
+    // `it++` keeps a copy of the record, since the buffer is reused:
+    int fd = open(records_path, O_RDONLY);
+    iterator_tpl::delimited_stream stream(fd, '\n', 4);
+    typedef iterator_tpl::delimited_stream::iterator stream_iterator;
+    stream_iterator sit = stream.begin();
+    stream_iterator::postfix_type first_record = sit++;
+    stream_iterator::postfix_type empty_record = sit++;
+    stream_iterator::postfix_type long_record = sit++;
+    ASSERT(std::string(first_record->data, first_record->size) == "first line");
+    ASSERT(empty_record->data && empty_record->size == 0);
+    ASSERT(std::string(long_record->data, long_record->size) ==
+           "a much longer line than the chunks");
+    ASSERT(std::string(sit->data, sit->size) == "last" && ++sit == stream.end());
+    close(fd);
+  }
+  ASSERT((std::is_same<std::iterator_traits<iterator_tpl::delimited_stream::iterator>
+                         ::iterator_category, std::input_iterator_tag>::value));
+  std::string fields(40, 'x');
+  fields[37] = ',';
+  ASSERT(iterator_tpl::find_delimiter(fields.data(), fields.size(), ',') == fields.data() + 37);
+  ASSERT(iterator_tpl::find_delimiter(fields.data(), 37, ',') == 0);
+  std::remove(records_path);
+  ASSERT(throws_system_error(records_path));
+
+  // Testing epoch-protected iteration:
+  ASSERT(alignof(iterator_tpl::epoch_domain) == 64);
+  {
+    myClass_concurrent cc;
+    for (int i = 0; i < 3; ++i) cc.push_front(i);
+    myClass_concurrent::iterator pinned = cc.begin();
+    ASSERT(cc.pop_front() && cc.domain.reclaim() == 1);
+    // The removed node is still visible to `pinned`:
+    ASSERT(*pinned == 2 && myClass_concurrent::deleted == 0);
+    myClass_concurrent::iterator pinned_copy = pinned;
+    pinned = cc.end();
+    ASSERT(cc.domain.reclaim() == 1 && *++pinned_copy == 1);
+    pinned_copy = cc.end();
+    ASSERT(cc.domain.reclaim() == 0 && myClass_concurrent::deleted == 1);
+
+    // Push iteration pins an epoch too:
+    int pushed_values = 0;
+    bool kept_while_pushing = true;
+    iterator_tpl::for_each(cc, [&](const int& v) {
+      if (pushed_values++ == 0) cc.pop_front();
+      kept_while_pushing = kept_while_pushing && cc.domain.reclaim() == 1;
+    });
+    ASSERT(pushed_values == 2 && kept_while_pushing);
+    ASSERT(cc.domain.reclaim() == 0 && myClass_concurrent::deleted == 2);
+
+    // More iterators than slots, each pinning a different epoch:
+    cc.push_front(2);
+    std::vector<myClass_concurrent::iterator> many;
+    for (size_t i = 0; i < 2 * iterator_tpl::epoch_domain::max_readers; ++i) {
+      many.push_back(cc.begin());
+      cc.push_front(3);
+      cc.pop_front();
+    }
+    std::vector<myClass_concurrent::iterator> many_copies(many);
+    ASSERT(*many_copies.back() == 2 && cc.domain.reclaim() > 0);
+    many.clear();
+    many_copies.clear();
+    ASSERT(cc.domain.reclaim() == 0);
+    int left = 0;
+    while (cc.pop_front()) ++left;
+    ASSERT(left == 2 && cc.domain.reclaim() == 0);
+    int deleted = myClass_concurrent::deleted;
+
+    std::atomic<bool> stop(false);
+    std::atomic<bool> sorted(true);
+    std::vector<std::thread> readers;
+    for (int r = 0; r < 4; ++r) {
+      readers.push_back(std::thread([&cc, &stop, &sorted]() {
+        while (!stop) {
+          int previous = 1 << 30;
+          for (const int& v : cc) {
+            if (v >= previous) sorted = false;
+            previous = v;
+          }
+        }
+      }));
+    }
+    for (int i = 3; i < 3000; ++i) {
+      cc.push_front(i);
+      if (i % 2) cc.pop_front();
+    }
+    stop = true;
+    for (std::thread& t : readers) t.join();
+    ASSERT(sorted && cc.domain.reclaim() == 0);
+    ASSERT(myClass_concurrent::deleted - deleted == 1499);
+  }
+  ASSERT(myClass_concurrent::deleted == 2 + 256 + 2 + 2997);
+
+  // Testing strided views:
+  std::vector<int> matrix(100 * 3);
+  for (size_t i = 0; i < matrix.size(); ++i) matrix[i] = int(i);
+  iterator_tpl::strided_view<int> col1 = iterator_tpl::column(&matrix[0], 100, 3, 1);
+  ASSERT(col1.size() == 100 && col1[2] == 7 && *(col1.begin() + 99) == 298);
+  ASSERT(col1.end() - col1.begin() == 100 && *col1.rbegin() == 298);
+  ASSERT(std::accumulate(col1.begin(), col1.end(), 0) == 3 * 4950 + 100);
+  block_sum gathered = { 0, 0 };
+  gathered = iterator_tpl::gather_blocks(col1, gathered);
+  ASSERT(gathered.sum == 3 * 4950 + 100 && gathered.blocks == 2);
+  iterator_tpl::strided_view<int, 3> col2 = { &matrix[2], 100, 0 };
+  for (int& x : col2) x = -x;
+  ASSERT(matrix[5] == -5 && matrix[4] == 4 && col2.stride() == 3);
+  const std::vector<int>& cmatrix = matrix;
+  iterator_tpl::strided_view<const int> ccol = iterator_tpl::strided(&cmatrix[0], 3, 99);
+  std::vector<int> backwards(ccol.rbegin(), ccol.rend());
+  ASSERT(backwards.size() == 3 && backwards[0] == 198 && backwards[2] == 0);
+
+  // Testing tiled traversal:
+  myClass_grid grid;
+  grid.w = 5; grid.h = 3; grid.d = 1;
+  for (int i = 0; i < 15; ++i) grid.cells.push_back(i);
+  std::vector<int> tiled(grid.begin(), grid.end());
+  int tiled_order[] = { 0, 1, 2, 3, 5, 6, 7, 8, 4, 9, 10, 11, 12, 13, 14 };
+  ASSERT(tiled.size() == 15 && std::equal(tiled.begin(), tiled.end(), tiled_order));
+  block_sum tile_rows = { 0, 0 };
+  tile_rows = iterator_tpl::for_each_block(grid, tile_rows);
+  ASSERT(tile_rows.sum == 105 && tile_rows.blocks == 6);
+  typedef iterator_tpl::iterator<myClass_grid, int&, myClass_grid::morton> morton_iterator;
+  std::vector<int> zorder(morton_iterator::begin(&grid), morton_iterator::end(&grid));
+  int morton_order[] = { 0, 1, 5, 6, 2, 3, 7, 8, 10, 11, 12, 13, 4, 9, 14 };
+  ASSERT(zorder.size() == 15 && std::equal(zorder.begin(), zorder.end(), morton_order));
+  grid.w = 3; grid.h = 3; grid.d = 3;
+  grid.cells.resize(27);
+  for (int i = 0; i < 27; ++i) grid.cells[i] = i;
+  typedef iterator_tpl::iterator<myClass_grid, int&, myClass_grid::morton_cubes> cube_iterator;
+  std::vector<int> cubes(cube_iterator::begin(&grid), cube_iterator::end(&grid));
+  ASSERT(cubes.size() == 27 && cubes[0] == 0 && cubes[1] == 1 && cubes[2] == 3 &&
+         cubes[4] == 9 && cubes[8] == 2);
+  std::sort(cubes.begin(), cubes.end());
+  ASSERT(std::unique(cubes.begin(), cubes.end()) == cubes.end() && cubes[26] == 26);
+  // Thin grids skip the Morton codes outside them:
+  grid.w = 300; grid.h = 2; grid.d = 1;
+  grid.cells.resize(600);
+  for (int i = 0; i < 600; ++i) grid.cells[i] = i;
+  std::vector<int> wide(morton_iterator::begin(&grid), morton_iterator::end(&grid));
+  bool wide_ok = wide.size() == 600;
+  for (int i = 0; wide_ok && i < 600; ++i) {
+    // (pairs of columns, top row first)
+    wide_ok = wide[i] == i / 4 * 2 + i % 2 + (i % 4 >= 2 ? 300 : 0);
+  }
+  ASSERT(wide_ok);
+  grid.w = 1; grid.h = 1; grid.d = 1000;
+  grid.cells.resize(1000);
+  for (int i = 0; i < 1000; ++i) grid.cells[i] = i;
+  std::vector<int> deep_cubes(cube_iterator::begin(&grid), cube_iterator::end(&grid));
+  std::vector<int> deep_order(1000);
+  std::iota(deep_order.begin(), deep_order.end(), 0);
+  ASSERT(deep_cubes == deep_order);
+
+  // Testing structure of arrays:
+  points pts;
+  const points& cpts = pts;
+  ASSERT(pts.begin() == pts.end() && pts.empty());
+  for (int i = 0; i < 5; ++i) pts.push_back(i, 10 * i);
+  ASSERT(pts.size() == 5 && pts[3].y == 30 && cpts[4].x == 4);
+  for (point_ref p : pts) p.x += 1;
+  points::iterator pit = pts.begin() + 2;
+  pit->y = -1;
+  ASSERT((*pit).x == 3 && pts.column<1>()[2] == -1);
+  int xsum = 0, ysum = 0;
+  for (points::const_iterator it = cpts.begin(); it != cpts.end(); ++it) {
+    xsum += it->x;
+    ysum += (*it).y;
+  }
+  ASSERT(xsum == 15 && ysum == 79);
+  ASSERT(cpts.end() - cpts.begin() == 5 && pts.rbegin()->x == 5);
+  points::const_iterator cpit = pts.begin();
+  ASSERT(cpit == pts.begin() && pts.end() != cpit && cpit->x == 1);
+  iterator_tpl::block<const int> xs = cpts.column_block<0>();
+  ASSERT(xs.size == 5 && xs.data[4] == 5);
+  ASSERT((std::is_same<points::field<1>::type, int>::value));
+#if VGSI_CHECKED_ITERATORS
+  ASSERT(throws([&]{ pts.push_back(0, 0); return ++pit; }));
+#endif
+
+  // Testing zip iterators:
+  myClass_random z1, z2;
+  const myClass_random& cz1 = z1;
+  for (int i = 0; i < 5; ++i) z1.vec.push_back(i);
+  for (int i = 0; i < 3; ++i) z2.vec.push_back(10 * i);
+  int zsum = 0;
+  for (std::tuple<const int&, int&> t : iterator_tpl::zip(cz1, z2)) {
+    zsum += std::get<0>(t) * std::get<1>(t);
+    std::get<1>(t) += 1;
+  }
+  ASSERT(zsum == 50 && z2.vec[2] == 21);
+  auto zr = iterator_tpl::zip(z1, z2);
+  ASSERT(zr.end() - zr.begin() == 3 && std::get<1>(zr.begin()[1]) == 11);
+  ASSERT(std::get<0>(*--zr.end()) == 2);
+  ASSERT((std::is_same<decltype(zr)::iterator::iterator_category,
+                       std::random_access_iterator_tag>::value));
+  zip_block zb = { 0, 0 };
+  zb = iterator_tpl::for_each_block(iterator_tpl::zip(cz1, z2), zb);
+  ASSERT(zb.calls == 1 && zb.sum == 53);
+
+  // Stops at the shortest, even if it is not random access:
+  zsum = 0;
+  for (auto t : iterator_tpl::zip(z1, c1, z2)) zsum += std::get<0>(t) + std::get<1>(t);
+  ASSERT(zsum == 9);
+  zb.calls = zb.sum = 0;
+  zb = iterator_tpl::for_each_block(iterator_tpl::zip(cz1, z2, c1), zb);
+  ASSERT(zb.calls == 3 && zb.sum == 59);
+
+  // Testing pipelines:
+  using iterator_tpl::pipe;
+  int calls = 0;
+  auto squares = pipe(z1) | iterator_tpl::map([&](int x) { ++calls; return x * x; })
+                          | iterator_tpl::filter(is_odd())
+                          | iterator_tpl::take(2);
+  std::vector<int> piped;
+  for (int x : squares) piped.push_back(x);
+  ASSERT(piped.size() == 2 && piped[0] == 1 && piped[1] == 9);
+  // Maps each element once and stops as soon as the second one is taken:
+  ASSERT(calls == 4);
+  for (int& x : pipe(z2) | iterator_tpl::filter(is_odd())) x -= 1;
+  ASSERT(z2.vec[0] == 0 && z2.vec[2] == 20);
+  int psum = 0;
+  for (int x : pipe(l2) | iterator_tpl::take(10)) psum += x;
+  ASSERT(psum == 6);
+  auto none_taken = pipe(cz1) | iterator_tpl::take(0);
+  ASSERT(none_taken.begin() == none_taken.end());
+
+  // Testing move and drain iterators:
+  myClass_strings s1;
+  const std::string big_string(100, 'x');
+  for (int i = 0; i < 3; ++i) s1.push_front(big_string);
+  std::vector<std::string> moved(s1.move_begin(), s1.move_end());
+  ASSERT(moved.size() == 3 && moved[2] == big_string);
+  ASSERT(s1.head && s1.head->value.empty());
+  ASSERT((std::is_same<decltype(*s1.move_begin()), std::string&&>::value));
+  ASSERT((std::is_same<std::iterator_traits<myClass_strings::drain_iterator>::iterator_category,
+                       std::input_iterator_tag>::value));
+  for (std::string& v : s1) v = big_string;
+  std::vector<std::string> drained(s1.drain_begin(), s1.drain_end());
+  ASSERT(drained == moved && s1.head == 0);
+  // `it++` keeps the value, since the node it left was deleted:
+  s1.push_front("b");
+  s1.push_front("a");
+  ASSERT(*s1.drain_begin()++ == "a" && s1.head && s1.head->value == "b");
+  myClass_strings::drain_iterator dit = s1.drain_begin();
+  std::string last_drained = *dit++;
+  ASSERT(last_drained == "b" && dit == s1.drain_end() && s1.head == 0);
+
+  // Testing cached iterators:
+  myClass_computed m1;
+  const myClass_computed& m2 = m1;
+  for (int i = 1; i <= 3; ++i) m1.vec.push_back(i);
+  myClass_computed::iterator mit = m1.begin();
+  ASSERT((*mit).x == 1 && mit->y == -1 && mit->x == 1);
+  ASSERT(m1.computed == 1);
+  ++mit;
+  ASSERT(mit->x == 2 && m1.computed == 2);
+  --mit;
+  ASSERT((*mit).x == 1 && m1.computed == 3);
+  int msum = 0;
+  for (myClass_computed::const_iterator it = m2.begin(); it != m2.end(); ++it) {
+    msum += it->x - it->y;
+  }
+  ASSERT(msum == 12 && m1.computed == 6);
+  ASSERT(m1.rbegin()->x == 3 && m2.rbegin()->y == -3);
+  ASSERT(c1_rvalue.begin().operator->().value == 0);
+
+  // Testing instrumentation:
+  typedef iterator_tpl::iterator_stats stats;
+  stats& lstats = stats::of<myClass_list, myClass_list::it_state>();
+  unsigned long long lnext = lstats.calls[iterator_tpl::detail::next_op];
+  unsigned long long lget = lstats.calls[iterator_tpl::detail::get_op];
+  for (int i = 0; i < 100; ++i) {
+    for (int& v : l1) lsum += v;
+  }
+  ASSERT(lstats.calls[iterator_tpl::detail::next_op] - lnext == 300);
+  ASSERT(lstats.calls[iterator_tpl::detail::get_op] - lget == 300);
+  ASSERT(lstats.sampled[iterator_tpl::detail::next_op] > 0);
+  ASSERT(lstats.container == "myClass_list" && lstats.state == "myClass_list::it_state");
+  ASSERT(stats::first().load() == &lstats);
+  std::ostringstream lreport;
+  stats::report(lreport);
+  ASSERT(lreport.str().find("myClass_list (myClass_list::it_state):\n  next: ") == 0);
+
+  // Testing checked iterators:
+#if VGSI_CHECKED_ITERATORS
+  myClass_checked k1, k2;
+  k1.push_back(1);
+  k2.push_back(1);
+  myClass_checked::iterator kit = k1.begin();
+  ASSERT(!throws([&]{ return *kit + (kit != k1.end()); }));
+  ASSERT(throws([&]{ return kit != k2.begin(); }));
+  ASSERT(throws([&]{ return *k1.end(); }));
+  ASSERT(throws([&]{ return ++k1.end(); }));
+  // (with `at_end()` instead of `checked_end`)
+  ASSERT(throws([&]{ return *myClass_list::iterator(l1.end()); }));
+  k1.push_back(2);
+  ASSERT(throws([&]{ return *kit; }));
+  ASSERT(throws([&]{ return ++kit; }));
+  ASSERT(throws([&]{ return r1.begin() < big.begin(); }));
+#endif
+
+#if __cplusplus >= 202002L
+  static_assert(std::sentinel_for<decltype(l1.end()), myClass_list::iterator>);
+  static_assert(std::contiguous_iterator<myClass_random::iterator>);
+  static_assert(std::contiguous_iterator<myClass_random::const_iterator>);
+  static_assert(std::random_access_iterator<myClass_random::reverse_iterator>);
+  static_assert(!std::contiguous_iterator<myClass_random::reverse_iterator>);
+  static_assert(std::bidirectional_iterator<myClass::iterator>);
+#endif
+
   return 0;
 }